@@ -0,0 +1,58 @@
+#ifndef WTT_DEMO_INCLUDE_ANALYSIS_MEMO_HPP
+#define WTT_DEMO_INCLUDE_ANALYSIS_MEMO_HPP
+
+#include "coefficient_store.hpp"
+#include "coefficient_ranking.hpp"
+#include "mesh_data.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <tuple>
+
+// FWT results keyed by the contentHash() of the analyzed mesh, the wavelet
+// type and the level count, so that analyzing a mesh again, e.g. after a
+// reset, only rebuilds the coarse mesh. The least recently used results are
+// evicted once they take more than the memory budget.
+class AnalysisMemo {
+public:
+  static constexpr std::size_t kDefaultBudget = std::size_t(256) << 20;
+
+  struct Result {
+    MeshSnapshot coarse;
+    CoefficientStore coefs;
+    CoefficientRanking ranking;
+  };
+
+  void setBudget(std::size_t bytes);
+  // Counts a hit or a miss. The result stays valid until the next insert().
+  const Result* find(std::uint64_t hash, int type, int level);
+  // A result larger than the whole budget is not kept.
+  void insert(std::uint64_t hash, int type, int level, Result result);
+  void clear();
+
+  std::size_t size() const { return entries_.size(); }
+  std::size_t hits() const { return hits_; }
+  std::size_t misses() const { return misses_; }
+  std::size_t memoryBytes() const { return bytes_; }
+
+private:
+  using Key = std::tuple<std::uint64_t, int, int>;
+
+  struct Entry {
+    Result result;
+    std::size_t bytes = 0;
+    std::uint64_t used = 0;
+  };
+
+  void evict();
+
+  std::map<Key, Entry> entries_;
+  std::size_t budget_ = kDefaultBudget;
+  std::size_t bytes_ = 0;
+  std::uint64_t clock_ = 0;
+  std::size_t hits_ = 0;
+  std::size_t misses_ = 0;
+};
+
+#endif
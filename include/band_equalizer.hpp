@@ -0,0 +1,43 @@
+#ifndef WTT_DEMO_INCLUDE_BAND_EQUALIZER_HPP
+#define WTT_DEMO_INCLUDE_BAND_EQUALIZER_HPP
+
+#include "incremental_synthesis.hpp"
+
+#include <vector>
+
+// Synthesis is linear, so the mesh reconstructed with band b scaled by g_b is
+//
+//   base + sum_b g_b * D_b
+//
+// where base is the coarse mesh synthesized without coefficients and D_b the
+// displacement band b alone produces. build() runs those level + 1 syntheses
+// once; afterwards a gain change is a multiply-add over the stored fields.
+class BandEqualizer {
+public:
+  bool build(const Mesh& coarse, const CoefficientStore& coefs, int level, const Synthesize& synthesize);
+  void clear();
+
+  bool built() const { return !handles_.empty(); }
+  int bandCount() const { return static_cast<int>(fields_.size()); }
+
+  // Moves the vertices of mesh() to the reconstruction under `gains`; bands
+  // without a gain keep 1.
+  void apply(const std::vector<double>& gains);
+
+  const Mesh& mesh() const { return mesh_; }
+  std::size_t memoryBytes() const;
+
+private:
+  struct Field {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+  };
+
+  Mesh mesh_;
+  std::vector<Mesh::Vertex_handle> handles_;
+  Field base_;
+  std::vector<Field> fields_;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef WTT_DEMO_INCLUDE_COEFFICIENT_RANKING_HPP
+#define WTT_DEMO_INCLUDE_COEFFICIENT_RANKING_HPP
+
+#include "coefficient_store.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Coefficient indices ordered by decreasing squared magnitude, ties kept in
+// index order. Built once per FWT; afterwards keeping the k largest
+// coefficients for any k is a range over order().
+class CoefficientRanking {
+public:
+  void build(const CoefficientStore& coefs);
+  void clear();
+
+  std::size_t size() const { return order_.size(); }
+  bool empty() const { return order_.empty(); }
+  const std::uint32_t* order() const { return order_.data(); }
+
+  // Number of coefficients kept when compressing to `perc` percent.
+  std::size_t keepCount(double perc) const;
+
+  // Zeroes every coefficient of `coefs` ranked below the first `keep`.
+  void zeroTail(CoefficientStore& coefs, std::size_t keep) const;
+
+private:
+  std::vector<std::uint32_t> order_;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef WTT_DEMO_INCLUDE_COEFFICIENT_STORE_HPP
+#define WTT_DEMO_INCLUDE_COEFFICIENT_STORE_HPP
+
+#include "custom_mesh_types.hpp"
+
+#include <cstddef>
+#include <vector>
+
+#ifdef WTT_FLOAT_COEFFICIENTS
+using CoefficientScalar = float;
+#else
+using CoefficientScalar = double;
+#endif
+
+// All wavelet coefficient bands in one buffer: separate x, y and z lanes,
+// band b occupying [bandBegin(b), bandEnd(b)) of every lane. Band 0 is the
+// coarsest one, matching the order wtlib produces.
+//
+// wtlib works on std::vector<std::vector<Vector_3>>; fromBands() and
+// toBands() convert at the call boundary so that everything else
+// (compression, denoising, padding) runs over the flat lanes. Each FWT and
+// IWT therefore holds a full Bands copy next to the store while wtlib runs.
+// Only with WTT_FLOAT_COEFFICIENTS is the store smaller than the Bands it
+// replaces; in double precision it takes the same bytes.
+class CoefficientStore {
+public:
+  using Scalar = CoefficientScalar;
+  using Vector3 = typename Mesh::Traits::Vector_3;
+  using Bands = std::vector<std::vector<Vector3>>;
+
+  void fromBands(const Bands& bands);
+  void toBands(Bands& bands) const;
+
+  // Gives every band the requested size, keeping existing values and filling
+  // new entries with zeros. Returns true if anything had to be padded.
+  bool resizeBands(const std::vector<std::size_t>& sizes);
+  // True if resizeBands(sizes) would leave the store as it is.
+  bool hasBandSizes(const std::vector<std::size_t>& sizes) const;
+  void clear();
+
+  std::size_t size() const { return x_.size(); }
+  bool empty() const { return x_.empty(); }
+  std::size_t bandCount() const { return offsets_.size() - 1; }
+  std::size_t bandBegin(std::size_t band) const { return offsets_[band]; }
+  std::size_t bandEnd(std::size_t band) const { return offsets_[band + 1]; }
+  std::size_t bandSize(std::size_t band) const { return offsets_[band + 1] - offsets_[band]; }
+  std::size_t memoryBytes() const;
+
+  Scalar* x() { return x_.data(); }
+  Scalar* y() { return y_.data(); }
+  Scalar* z() { return z_.data(); }
+  const Scalar* x() const { return x_.data(); }
+  const Scalar* y() const { return y_.data(); }
+  const Scalar* z() const { return z_.data(); }
+
+  Vector3 at(std::size_t i) const { return Vector3(x_[i], y_[i], z_[i]); }
+  Scalar squaredNorm(std::size_t i) const { return x_[i] * x_[i] + y_[i] * y_[i] + z_[i] * z_[i]; }
+  void setZero(std::size_t begin, std::size_t end);
+  void scale(std::size_t begin, std::size_t end, Scalar factor);
+
+private:
+  std::vector<Scalar> x_;
+  std::vector<Scalar> y_;
+  std::vector<Scalar> z_;
+  std::vector<std::size_t> offsets_ = {0};
+};
+
+#endif
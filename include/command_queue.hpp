@@ -0,0 +1,72 @@
+#ifndef WTT_DEMO_INCLUDE_COMMAND_QUEUE_HPP
+#define WTT_DEMO_INCLUDE_COMMAND_QUEUE_HPP
+
+#include "job_control.hpp"
+
+#include <QMutex>
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+
+// Commands posted from any thread and run one at a time by a consumer
+// thread, in the order they were posted. Every command has a kind:
+//
+//   COALESCE  a newer command replaces a pending one of its kind and goes
+//             to the back, so a burst costs one run of its last command.
+//   PREEMPT   a newer command also cancels a running one of its kind.
+//   CANCEL    cancel() drops pending commands of the kind and cancels a
+//             running one.
+//   YIELD     a running command of the kind is cancelled as soon as a
+//             command of another kind is posted, for work done while idle.
+//
+// The running command is cancelled through the JobControl, which take()
+// resets for every command.
+class CommandQueue {
+public:
+  using Command = std::function<void()>;
+  enum Policy {
+    COALESCE = 1,
+    PREEMPT = 2,
+    CANCEL = 4,
+    YIELD = 8
+  };
+
+  explicit CommandQueue(JobControl& job): job_(job), running_(-1), scheduled_(false) {}
+
+  void setPolicy(int kind, int policy);
+
+  // Returns whether the consumer is idle and has to be woken up to take().
+  bool post(int kind, Command command);
+  // Takes the oldest command; once there is none the consumer counts as
+  // idle again.
+  bool take(int& kind, Command& command);
+
+  // Returns how many pending commands were dropped.
+  std::size_t cancel();
+
+  // Kind of the command taken last, -1 when idle.
+  int running() const;
+  bool pending(int kind) const;
+  // Whether the running command has a newer one of its kind waiting to
+  // replace its results.
+  bool superseded() const;
+
+private:
+  struct Entry {
+    int kind;
+    Command command;
+  };
+
+  int policy(int kind) const;
+
+  JobControl& job_;
+  mutable QMutex mutex_;
+  std::deque<Entry> entries_;
+  std::map<int, int> policies_;
+  int running_;
+  bool scheduled_;
+};
+
+#endif
@@ -21,10 +21,10 @@ public:
   MeshVertex() {}
   MeshVertex(const Point& p): Base(p) {}
 
-  int id;
-  int type;
-  int level;
-  bool border;
+  int id = 0;
+  int type = 0;
+  int level = 0;
+  bool border = false;
   std::pair<Vertex_handle, Vertex_handle> parents;
 };
 
@@ -87,11 +87,11 @@ public:
 
 struct BoundingBox {
   double xmin = std::numeric_limits<double>::max();
-  double xmax = std::numeric_limits<double>::min();
+  double xmax = std::numeric_limits<double>::lowest();
   double ymin = std::numeric_limits<double>::max();
-  double ymax = std::numeric_limits<double>::min();
+  double ymax = std::numeric_limits<double>::lowest();
   double zmin = std::numeric_limits<double>::max();
-  double zmax = std::numeric_limits<double>::min();
+  double zmax = std::numeric_limits<double>::lowest();
 
   double xc = 0.0;
   double yc = 0.0;
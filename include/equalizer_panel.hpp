@@ -0,0 +1,40 @@
+#ifndef WTT_DEMO_INCLUDE_EQUALIZER_PANEL_HPP
+#define WTT_DEMO_INCLUDE_EQUALIZER_PANEL_HPP
+
+#include <QWidget>
+#include <QVector>
+
+class QSlider;
+class QLabel;
+class QHBoxLayout;
+
+// One vertical slider per wavelet band, 0% to 200% gain, band 0 (coarsest)
+// on the left.
+class EqualizerPanel: public QWidget {
+  Q_OBJECT
+public:
+  explicit EqualizerPanel(QWidget* parent = 0);
+  virtual ~EqualizerPanel();
+
+  QVector<double> gains() const;
+
+signals:
+  void gainsChanged(QVector<double> gains);
+  // After the last gainsChanged() of a drag, or after a single step.
+  void gainsCommitted();
+
+public slots:
+  void setBandCount(int count);
+  void resetGains();
+  // Moves the sliders without emitting gainsChanged().
+  void setGains(QVector<double> gains);
+
+protected:
+  void onSliderMoved();
+
+  QHBoxLayout* sliders_layout_;
+  QVector<QSlider*> sliders_;
+  QVector<QLabel*> labels_;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef WTT_DEMO_INCLUDE_INCREMENTAL_SYNTHESIS_HPP
+#define WTT_DEMO_INCLUDE_INCREMENTAL_SYNTHESIS_HPP
+
+#include "level_operator.hpp"
+#include "mesh_data.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Sparse per-vertex displacement, vertices given by id.
+struct DeltaField {
+  std::vector<std::uint32_t> index;
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> z;
+
+  std::size_t size() const { return index.size(); }
+  void clear() {
+    index.clear();
+    x.clear();
+    y.clear();
+    z.clear();
+  }
+  void push(std::uint32_t i, double dx, double dy, double dz) {
+    index.push_back(i);
+    x.push_back(dx);
+    y.push_back(dy);
+    z.push_back(dz);
+  }
+};
+
+// Keeps what an IWT was computed from, the coarse mesh as a snapshot, so that later coefficient edits only
+// push the difference to the previous coefficients through the remaining
+// levels instead of repeating the whole synthesis. The operators are compiled
+// on the first update and checked against the mesh the full synthesis
+// produced; if that fails every update falls back to a full synthesis. Edits
+// touching a large share of the coefficients run the whole operator chain,
+// which is parallel, instead of the sparse propagation.
+//
+// Compiling probes wtlib several times per level, which costs more than one
+// full synthesis, and gives operators equal to wtlib only up to rounding.
+// Like TransformCache it is therefore off, and every update is a full
+// synthesis, unless built with WTT_COMPILED_TRANSFORMS.
+class IncrementalSynthesis {
+public:
+  void setCompiling(bool compiling) { compiling_ = compiling; }
+  bool compiling() const { return compiling_; }
+
+  void record(MeshSnapshot coarse, int level, const CoefficientStore& coefs, const Synthesize& synthesize);
+  // Operators already compiled for the recorded synthesis, e.g. by a
+  // TransformCache; they are still checked on the first update.
+  void share(const LevelChain& operators);
+  void clear();
+  bool recorded() const { return level_ > 0; }
+  const MeshSnapshot& coarse() const { return coarse_; }
+  int level() const { return level_; }
+
+  // Makes `mesh`, the result of the recorded synthesis, match `coefs`.
+  // Returns false if `coefs` does not have the recorded band layout.
+  bool update(const CoefficientStore& coefs, Mesh& mesh);
+
+  bool compiled() const { return compiled_; }
+  std::size_t lastChanged() const { return last_changed_; }
+  std::size_t lastMoved() const { return last_moved_; }
+  std::size_t memoryBytes() const;
+
+protected:
+  bool compile(Mesh& mesh);
+  bool verify(const Mesh& mesh);
+  void synthesizeDense(const CoefficientStore& coefs, std::vector<double> (&p)[3]) const;
+  void propagate(const std::vector<DeltaField>& band_deltas, DeltaField& result);
+
+  MeshSnapshot coarse_;
+  int level_ = 0;
+  CoefficientStore applied_;
+  Synthesize synthesize_;
+
+#ifdef WTT_COMPILED_TRANSFORMS
+  bool compiling_ = true;
+#else
+  bool compiling_ = false;
+#endif
+  bool compiled_ = false;
+  bool failed_ = false;
+  LevelChain operators_;
+  std::vector<Mesh::Vertex_handle> handles_;
+  std::size_t last_changed_ = 0;
+  std::size_t last_moved_ = 0;
+
+  std::vector<double> acc_x_;
+  std::vector<double> acc_y_;
+  std::vector<double> acc_z_;
+  std::vector<std::uint8_t> touched_;
+};
+
+#endif
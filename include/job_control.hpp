@@ -0,0 +1,47 @@
+#ifndef WTT_DEMO_INCLUDE_JOB_CONTROL_HPP
+#define WTT_DEMO_INCLUDE_JOB_CONTROL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// Lets another thread stop a running job and watch how far it got. The job
+// polls cancelled() wherever it can still back out without having changed
+// anything, and calls report() with the work done out of the work it has.
+class JobControl {
+public:
+  // Runs on the reporting thread, which may be a pool worker.
+  using Progress = std::function<void(std::int64_t done, std::int64_t total)>;
+  // Runs on the job's thread when cancel() starts or stops taking effect.
+  using Cancellable = std::function<void(bool cancellable)>;
+
+  JobControl(): cancelled_(false) {}
+
+  void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  void reset() { cancelled_.store(false, std::memory_order_relaxed); }
+  bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+  // Only between the parallel parts of a job.
+  void setProgress(Progress progress) { progress_ = std::move(progress); }
+  void report(std::int64_t done, std::int64_t total) const {
+    if (progress_) {
+      progress_(done, total);
+    }
+  }
+
+  // Jobs call reportCancellable(false) before a part that never polls
+  // cancelled(), and true once they poll again.
+  void setCancellable(Cancellable cancellable) { cancellable_ = std::move(cancellable); }
+  void reportCancellable(bool cancellable) const {
+    if (cancellable_) {
+      cancellable_(cancellable);
+    }
+  }
+
+private:
+  std::atomic<bool> cancelled_;
+  Progress progress_;
+  Cancellable cancellable_;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef WTT_DEMO_INCLUDE_LEVEL_OPERATOR_HPP
+#define WTT_DEMO_INCLUDE_LEVEL_OPERATOR_HPP
+
+#include "custom_mesh_types.hpp"
+#include "coefficient_store.hpp"
+#include "job_control.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Sparse matrix stored column by column.
+struct SparseColumns {
+  std::vector<std::size_t> starts = {0};
+  std::vector<std::uint32_t> rows;
+  std::vector<double> weights;
+
+  std::size_t columnCount() const { return starts.size() - 1; }
+  std::size_t nonZeros() const { return rows.size(); }
+  void clear() {
+    starts.assign(1, 0);
+    rows.clear();
+    weights.clear();
+  }
+};
+
+// Sparse matrix stored row by row.
+struct SparseRows {
+  std::vector<std::size_t> starts = {0};
+  std::vector<std::uint32_t> columns;
+  std::vector<double> weights;
+
+  std::size_t rowCount() const { return starts.size() - 1; }
+  std::size_t nonZeros() const { return columns.size(); }
+  void clear() {
+    starts.assign(1, 0);
+    columns.clear();
+    weights.clear();
+  }
+};
+
+// Synthesizes `level` levels of `bands` onto `mesh`, e.g. wtlib::loop_synthesize.
+using Synthesize = std::function<void(Mesh&, const CoefficientStore::Bands&, int)>;
+// Analyzes `level` levels of `mesh` into `bands`, e.g. wtlib::loop_analyze.
+using Analyze = std::function<bool(Mesh&, CoefficientStore::Bands&, int)>;
+
+// `type` is a WTTManager::WTType, 0 for Loop and 1 for Butterfly.
+Synthesize synthesizer(int type);
+Analyze analyzer(int type);
+
+// Collects the vertices of `mesh` by id; fails unless the ids are a
+// permutation of [0, n).
+bool verticesById(Mesh& mesh, std::vector<Mesh::Vertex_handle>& handles);
+bool verticesById(const Mesh& mesh, std::vector<Mesh::Vertex_const_handle>& handles);
+
+// Coordinates of `mesh` by vertex id; the ids must be a permutation.
+void readPositions(const Mesh& mesh, std::vector<double>& x, std::vector<double>& y, std::vector<double>& z);
+
+// One level of the wavelet transform as a linear map, applied to every
+// coordinate alike. Inputs and outputs are indexed in the id space of the
+// level's finer mesh: ids below coarseSize() are the coarse vertices, the
+// band coefficient k sits at coarseSize() + k.
+//
+//   synthesis:  fine = M * [coarse; band]
+//   analysis:   [coarse; band] = M * fine
+//
+// The columns are captured by running wtlib on position-free copies of the
+// mesh holding unit impulses. Inputs whose anchor vertices are more than
+// 2 * radius edges apart in the finer mesh get the same color and share one
+// run; the three coordinates carry three colors at once. A column writes only
+// within `radius` of its anchor, so columns of one color never write the
+// same row. The matrix is also kept row by row with the entries of each row
+// in color order; apply() gathers the rows in parallel, which sums every row
+// in that order whatever the thread count.
+class LevelOperator {
+public:
+  enum Direction {
+    SYNTHESIS = 0,
+    ANALYSIS = 1
+  };
+
+  // Radii worth trying; the Loop and Butterfly lifting stencils of wtlib
+  // reach two rings.
+  static constexpr int kMinRadius = 2;
+  static constexpr int kMaxRadius = 4;
+
+  // Both fail when the ids are not contiguous, when some response reaches
+  // beyond `radius` or when `job` is cancelled between two runs. The other
+  // side of the level is returned in `fine` or `coarse` either way.
+  bool compileSynthesis(const Mesh& coarse,
+                        std::size_t band_size,
+                        const Synthesize& synthesize,
+                        int radius,
+                        Mesh& fine,
+                        const JobControl* job = nullptr);
+  bool compileAnalysis(const Mesh& fine,
+                       const Analyze& analyze,
+                       int radius,
+                       Mesh& coarse,
+                       const JobControl* job = nullptr);
+  void clear();
+
+  Direction direction() const { return direction_; }
+  std::size_t size() const { return columns_.columnCount(); }
+  std::size_t coarseSize() const { return coarse_size_; }
+  std::size_t bandSize() const { return size() - coarse_size_; }
+  const SparseColumns& columns() const { return columns_; }
+  const SparseRows& rows() const { return rows_; }
+  std::size_t colorCount() const { return color_starts_.size() - 1; }
+  std::size_t runs() const { return runs_; }
+  std::size_t memoryBytes() const;
+
+  // out = M * in on the x, y and z lanes, each holding size() values.
+  void apply(const double* const in[3], double* const out[3]) const;
+
+protected:
+  using Probe = std::function<bool(const double* const in[3], double* const out[3])>;
+  bool capture(const Mesh& fine, int radius, const Probe& probe, const JobControl* job);
+  void buildRows();
+
+  Direction direction_ = SYNTHESIS;
+  std::size_t coarse_size_ = 0;
+  SparseColumns columns_;
+  SparseRows rows_;
+  std::vector<std::size_t> color_starts_ = {0};
+  std::vector<std::uint32_t> color_columns_;
+  std::size_t runs_ = 0;
+};
+
+// Operators of consecutive levels, shared by everything compiled from them.
+using LevelChain = std::shared_ptr<const std::vector<LevelOperator>>;
+
+#endif
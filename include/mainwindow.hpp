@@ -3,12 +3,16 @@
 #include "custom_mesh_types.hpp"
 #include "logger.hpp"
 #include <QMainWindow>
+#include <QVector>
 class QResizeEvent;
+class QLabel;
+class QPushButton;
 class OpenGLWidget;
 class SceneObject;
 
 class IntegerSetter;
 class InputProp;
+class EqualizerPanel;
 
 class WTTManager;
 
@@ -32,6 +36,8 @@ protected:
 
   void initializeGeometry();
   void initWidgets();
+  void placeEqualizerPanel();
+  void openProcessing();
 
   void setupConnections();
 
@@ -54,6 +60,11 @@ public slots:
   void onDenoiseDone(QString msg);
 
   void onUpdateMeshInfo(int, int);
+  void onCancelJob();
+  void onJobProgress(QString text);
+  void onJobCancellable(bool cancellable);
+  void onJobCancelled();
+  void onHistoryStepped(int levels, QVector<double> gains);
 
 signals:
   void openGLContextReady();
@@ -67,6 +78,9 @@ signals:
   void doIWT(int type, int level);
   void doCompress(double perc);
   void doDenoise(int level);
+  void setBandGains(QVector<double> gains);
+  void undo();
+  void redo();
 
 protected:
   Ui::MainWindow* ui_ptr_;
@@ -75,12 +89,15 @@ protected:
   OpenGLWidget* opengl_widget_ptr_;
   ActionPanel* action_panel_ptr_;
   MessageBox* proc_diag_ptr_;
+  QLabel* proc_status_ptr_;
+  QPushButton* proc_cancel_ptr_;
   MessageBox* msg_prop_ptr_;
   MessageBox* wt_type_setter_ptr_;
   IntegerSetter* fwt_level_setter_ptr_;
   IntegerSetter* iwt_level_setter_ptr_;
   IntegerSetter* denoise_level_setter_ptr_;
   InputProp* compress_rate_setter_ptr_;
+  EqualizerPanel* equalizer_panel_ptr_;
   WTTManager* wtt_manager_;
   int wt_type_;
 
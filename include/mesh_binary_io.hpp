@@ -0,0 +1,50 @@
+#ifndef WTT_DEMO_INCLUDE_MESH_BINARY_IO_HPP
+#define WTT_DEMO_INCLUDE_MESH_BINARY_IO_HPP
+
+#include "mesh_data.hpp"
+
+#include <QString>
+
+// Native mesh container (.wttm), little endian, sections aligned to 8 bytes:
+//
+//   offset  size        field
+//   0       4           magic "WTTM"
+//   4       4           format version
+//   8       4           flags, bit 0 set when vertex tags are present
+//   12      4           reserved, 0
+//   16      8           vertex count n
+//   24      8           face count m
+//   32      24n         vertex coordinates, double x/y/z
+//           12m         triangle vertex indices, uint32
+//           4n 4n 4n n  MeshVertex id, type, level (int32), border (uint8)
+//
+// Loading maps the file and hands the arrays to the Polyhedron builder
+// directly, so no text is parsed and nothing is copied on little endian hosts.
+class MeshBinaryIO {
+public:
+  enum Status {
+    OK = 0,
+    OPEN_ERROR = 1,
+    FORMAT_ERROR = 2,
+    BUILD_ERROR = 3,
+    WRITE_ERROR = 4
+  };
+  enum Flags {
+    HAS_VERTEX_TAGS = 1
+  };
+  static const quint32 kVersion = 1;
+  static QString suffix() { return "wttm"; }
+
+  Status save(const QString& filename, const Mesh& mesh);
+  Status save(const QString& filename, const MeshData& data);
+  Status load(const QString& filename, Mesh& mesh);
+
+  qint64 nsecs() const { return nsecs_; }
+  const QString& errorString() const { return err_; }
+
+protected:
+  qint64 nsecs_ = 0;
+  QString err_;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef WTT_DEMO_INCLUDE_MESH_DATA_HPP
+#define WTT_DEMO_INCLUDE_MESH_DATA_HPP
+
+#include "custom_mesh_types.hpp"
+
+#include <CGAL/Polyhedron_incremental_builder_3.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Flat triangle soup: three coordinates per vertex, three vertex indices per
+// face. Used to move mesh data in and out of the CGAL Polyhedron. The
+// MeshVertex fields are optional and left empty when not captured.
+struct MeshData {
+  std::vector<double> positions;
+  std::vector<std::uint32_t> triangles;
+  std::vector<std::int32_t> ids;
+  std::vector<std::int32_t> types;
+  std::vector<std::int32_t> levels;
+  std::vector<std::uint8_t> borders;
+
+  std::size_t vertexCount() const { return positions.size() / 3; }
+  std::size_t faceCount() const { return triangles.size() / 3; }
+  bool hasTags() const { return vertexCount() > 0 && ids.size() == vertexCount(); }
+  void clear() {
+    positions.clear();
+    triangles.clear();
+    ids.clear();
+    types.clear();
+    levels.clear();
+    borders.clear();
+  }
+};
+
+template <class HDS>
+class FlatMeshBuilder: public CGAL::Modifier_base<HDS> {
+public:
+  using Point = typename HDS::Vertex::Point;
+  using Builder = CGAL::Polyhedron_incremental_builder_3<HDS>;
+
+  FlatMeshBuilder(const double* positions,
+                  std::size_t vsize,
+                  const std::uint32_t* triangles,
+                  std::size_t fsize):
+  positions_(positions),
+  triangles_(triangles),
+  vsize_(vsize),
+  fsize_(fsize),
+  succeeded_(false)
+  {}
+
+  void operator()(HDS& hds) override {
+    Builder builder(hds, false);
+    builder.begin_surface(vsize_, fsize_, 3 * fsize_);
+    for (std::size_t v = 0; v < vsize_; ++v) {
+      const double* p = positions_ + 3 * v;
+      builder.add_vertex(Point(p[0], p[1], p[2]))->id = static_cast<int>(v);
+    }
+    for (std::size_t f = 0; f < fsize_ && !builder.error(); ++f) {
+      const std::uint32_t* t = triangles_ + 3 * f;
+      builder.begin_facet();
+      builder.add_vertex_to_facet(t[0]);
+      builder.add_vertex_to_facet(t[1]);
+      builder.add_vertex_to_facet(t[2]);
+      builder.end_facet();
+    }
+    if (builder.error()) {
+      builder.rollback();
+      succeeded_ = false;
+      return;
+    }
+    builder.end_surface();
+    succeeded_ = !builder.error();
+  }
+
+  bool succeeded() const { return succeeded_; }
+
+private:
+  const double* positions_;
+  const std::uint32_t* triangles_;
+  std::size_t vsize_;
+  std::size_t fsize_;
+  bool succeeded_;
+};
+
+// Builds `mesh` from flat arrays; vertex ids follow the array order.
+bool buildMesh(Mesh& mesh,
+               const double* positions,
+               std::size_t vsize,
+               const std::uint32_t* triangles,
+               std::size_t fsize);
+bool buildMesh(Mesh& mesh, const MeshData& data);
+
+// Copies the MeshVertex fields from flat arrays onto the vertices of `mesh`
+// in iteration order, which is the order buildMesh() created them in.
+void applyVertexTags(Mesh& mesh,
+                     const std::int32_t* ids,
+                     const std::int32_t* types,
+                     const std::int32_t* levels,
+                     const std::uint8_t* borders);
+
+// Flattens `mesh`. Vertices are placed at their id when the ids are a
+// permutation of [0, n), otherwise in iteration order.
+void extractMeshData(const Mesh& mesh, MeshData& data, bool with_tags);
+
+// Immutable flattened mesh, shared by its copies. Holds about 60 bytes per
+// vertex where a Polyhedron holds several hundred, and rebuilds the mesh in
+// one pass of the incremental builder.
+class MeshSnapshot {
+public:
+  MeshSnapshot() = default;
+  // Takes the vertex tags along.
+  explicit MeshSnapshot(const Mesh& mesh);
+  // Takes over `data`, e.g. a freshly parsed file.
+  explicit MeshSnapshot(MeshData&& data);
+
+  bool empty() const { return !data_ || data_->vertexCount() == 0; }
+  const MeshData& data() const;
+  // Rebuilds `mesh` as it was flattened, borders normalized.
+  bool restore(Mesh& mesh) const;
+  std::size_t memoryBytes() const;
+
+private:
+  std::shared_ptr<const MeshData> data_;
+};
+
+// Hash of everything in `data` but the positions: the triangles and, when
+// captured, the MeshVertex fields.
+std::uint64_t connectivityHash(const MeshData& data);
+// connectivityHash() with the bit patterns of the positions mixed in.
+std::uint64_t contentHash(const MeshData& data);
+// Hash of the vertex count and the vertex ids of every facet of `mesh`.
+std::uint64_t triangleHash(const Mesh& mesh);
+
+#endif
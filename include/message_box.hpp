@@ -7,6 +7,7 @@ namespace Ui {
 }
 
 class QLabel;
+class QPushButton;
 class MessageBox: public ModalWidget {
   Q_OBJECT
 public:
@@ -14,6 +15,10 @@ public:
   virtual ~MessageBox();
   void addAcceptButton(const QString& name);
   void addRejectButton(const QString& name);
+  // A button that leaves the box open; connect to its clicked().
+  QPushButton* addButton(const QString& name, const QString& object_name);
+  // A centered label under the description.
+  QLabel* addLabel(const QString& name);
 
   void resetStyleSheet(const QString& filename);
   QLabel* getDescription();
@@ -0,0 +1,44 @@
+#ifndef WTT_DEMO_INCLUDE_OFF_LOADER_HPP
+#define WTT_DEMO_INCLUDE_OFF_LOADER_HPP
+
+#include "mesh_data.hpp"
+#include "job_control.hpp"
+
+#include <QString>
+
+// Reads ASCII OFF files by memory mapping them and parsing the vertex and
+// face blocks in parallel, line-aligned chunks. Only triangle faces are
+// accepted; per-vertex colors or normals trailing the coordinates are ignored.
+class OFFLoader {
+public:
+  enum Status {
+    OK = 0,
+    OPEN_ERROR = 1,
+    PARSE_ERROR = 2,
+    NOT_TRIANGLE = 3,
+    CANCELLED = 4
+  };
+
+  struct Stats {
+    qint64 bytes = 0;
+    qint64 nsecs = 0;
+    double throughput() const {
+      return nsecs > 0 ? (bytes / (1024.0 * 1024.0)) / (nsecs * 1e-9) : 0.0;
+    }
+  };
+
+  // Reports the body bytes parsed to `job` and stops with CANCELLED, and
+  // `data` empty, once it is cancelled.
+  Status load(const QString& filename, MeshData& data, const JobControl* job = nullptr);
+
+  const Stats& stats() const { return stats_; }
+  const QString& errorString() const { return err_; }
+
+protected:
+  Status parse(const char* begin, const char* end, MeshData& data, const JobControl* job);
+
+  Stats stats_;
+  QString err_;
+};
+
+#endif
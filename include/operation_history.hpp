@@ -0,0 +1,110 @@
+#ifndef WTT_DEMO_INCLUDE_OPERATION_HISTORY_HPP
+#define WTT_DEMO_INCLUDE_OPERATION_HISTORY_HPP
+
+#include "coefficient_store.hpp"
+#include "coefficient_ranking.hpp"
+#include "mesh_data.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Sparse change of a CoefficientStore: the x, y and z values before and
+// after of every coefficient that changed, in index order.
+struct CoefficientDelta {
+  using Scalar = CoefficientStore::Scalar;
+
+  // Coefficient count of the stores it applies to.
+  std::size_t size = 0;
+  std::vector<std::uint32_t> index;
+  std::vector<Scalar> before;
+  std::vector<Scalar> after;
+
+  bool empty() const { return index.empty(); }
+  // `from` and `to` must have the same layout.
+  static CoefficientDelta diff(const CoefficientStore& from, const CoefficientStore& to);
+  // Writes the values after, or before, the change into `coefs`; fails
+  // unless it has `size` coefficients.
+  bool apply(CoefficientStore& coefs, bool forward) const;
+  // Extends this delta by `next`, which starts where this one ends.
+  void append(const CoefficientDelta& next);
+  std::size_t memoryBytes() const;
+};
+
+// The WTTManager settings the working coefficients are derived from.
+struct OperationParams {
+  int fwt_type = 0;
+  int fwt_level = 0;
+  double compress_perc = 100.0;
+  int denoise_level = -1;
+  std::vector<double> band_gains;
+  // Whether the band equalizer preview is shown.
+  bool preview = false;
+};
+
+// What an FWT or IWT replaced, put back when it is undone.
+struct TransformState {
+  MeshSnapshot mesh;
+  bool modified = false;
+  // Coefficients are only kept when the transform changed them.
+  bool has_coefs = false;
+  CoefficientStore coefs;
+  CoefficientStore fwt_coefs;
+  CoefficientRanking ranking;
+  // The IWT the mesh came from, level 0 if none.
+  MeshSnapshot synthesis_coarse;
+  int synthesis_level = 0;
+  int synthesis_type = 0;
+
+  std::size_t memoryBytes() const;
+};
+
+// One undoable operation. Transforms are undone by putting `state` back
+// and redone by running them again; parameter edits both ways by applying
+// `delta`.
+struct HistoryEntry {
+  int kind = 0;
+  int type = 0;
+  int level = 0;
+  OperationParams before;
+  OperationParams after;
+  TransformState state;
+  CoefficientDelta delta;
+  std::size_t bytes = 0;
+};
+
+// Undo and redo stacks within a memory budget. The oldest undo entries are
+// evicted first, then the redo entries furthest away.
+class OperationHistory {
+public:
+  static constexpr std::size_t kDefaultBudget = std::size_t(256) << 20;
+
+  void setBudget(std::size_t bytes);
+  // Records a new operation. Anything to redo is dropped unless the
+  // operation is itself being redone.
+  void push(HistoryEntry entry, bool redoing);
+  // Folds a parameter edit into the last entry if that is an edit of the
+  // same kind and nothing is to be redone.
+  bool merge(int kind, const OperationParams& after, const CoefficientDelta& delta);
+
+  bool canUndo() const { return !undo_.empty(); }
+  bool canRedo() const { return !redo_.empty(); }
+  HistoryEntry takeUndo();
+  void pushRedo(HistoryEntry entry);
+  HistoryEntry takeRedo();
+  void clear();
+
+  std::size_t memoryBytes() const { return bytes_; }
+
+private:
+  static std::size_t entryBytes(const HistoryEntry& entry);
+  void evict();
+
+  std::deque<HistoryEntry> undo_;
+  std::vector<HistoryEntry> redo_;
+  std::size_t budget_ = kDefaultBudget;
+  std::size_t bytes_ = 0;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef WTT_DEMO_INCLUDE_PACKED_VERTEX_HPP
+#define WTT_DEMO_INCLUDE_PACKED_VERTEX_HPP
+
+#include <QOpenGLFunctions>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// Box the positions are stored as fractions of; every extent is positive.
+struct PositionRange {
+  double origin[3] = {0.0, 0.0, 0.0};
+  double extent[3] = {1.0, 1.0, 1.0};
+};
+
+#ifdef WTT_FLOAT_POSITIONS
+// One interleaved render vertex of 16 bytes. Positions are float fractions
+// of the mesh bounding box, scaled back in the vertex shader; normals are
+// GL_INT_2_10_10_10_REV.
+struct PackedVertex {
+  GLfloat position[3];
+  GLuint normal;
+};
+
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay tightly packed");
+
+constexpr GLenum kPackedPositionType = GL_FLOAT;
+
+inline GLfloat quantizePosition(double value, const PositionRange& range, int ch) {
+  return static_cast<GLfloat>((value - range.origin[ch]) / range.extent[ch]);
+}
+#else
+// One interleaved render vertex of 12 bytes. Positions are 16-bit fractions
+// of the mesh bounding box, read as normalized unsigned shorts and scaled
+// back in the vertex shader; normals are GL_INT_2_10_10_10_REV.
+struct PackedVertex {
+  GLushort position[4];
+  GLuint normal;
+};
+
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex must stay tightly packed");
+
+constexpr GLenum kPackedPositionType = GL_UNSIGNED_SHORT;
+
+inline GLushort quantizePosition(double value, const PositionRange& range, int ch) {
+  double q = std::round((value - range.origin[ch]) / range.extent[ch] * 65535.0);
+  return static_cast<GLushort>(std::min(std::max(q, 0.0), 65535.0));
+}
+#endif
+
+inline void packPosition(PackedVertex& pv, double x, double y, double z, const PositionRange& range) {
+  pv.position[0] = quantizePosition(x, range, 0);
+  pv.position[1] = quantizePosition(y, range, 1);
+  pv.position[2] = quantizePosition(z, range, 2);
+#ifndef WTT_FLOAT_POSITIONS
+  pv.position[3] = 0;
+#endif
+}
+
+inline GLuint packNormal(float x, float y, float z) {
+  auto pack = [](float v) {
+    int q = static_cast<int>(std::round(std::min(std::max(v, -1.0f), 1.0f) * 511.0f));
+    return static_cast<GLuint>(q) & 0x3ffu;
+  };
+  return pack(x) | (pack(y) << 10) | (pack(z) << 20);
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef WTT_DEMO_INCLUDE_PARALLEL_FOR_HPP
+#define WTT_DEMO_INCLUDE_PARALLEL_FOR_HPP
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Threads a parallelFor() spreads over, the caller included.
+inline std::size_t parallelWorkerCount() {
+  if (ThreadPool* pool = ThreadPool::current()) {
+    return pool->workerCount() + 1;
+  }
+  std::size_t n = std::thread::hardware_concurrency();
+  return n == 0 ? 1 : n;
+}
+
+// Splits [begin, end) into at most parallelWorkerCount() contiguous ranges of
+// at least `grain` items and calls func(range_begin, range_end) for each of
+// them. The calling thread runs the last range itself. The ranges run as
+// tasks of ThreadPool::current(), timed under `label`, or on threads of
+// their own when no pool is set.
+template <class Func>
+void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, Func func,
+                 const char* label = "parallelFor") {
+  if (end <= begin) {
+    return;
+  }
+  std::size_t size = end - begin;
+  std::size_t chunks = std::min(parallelWorkerCount(), (size + grain - 1) / std::max<std::size_t>(grain, 1));
+  if (chunks <= 1) {
+    func(begin, end);
+    return;
+  }
+  std::size_t step = (size + chunks - 1) / chunks;
+  std::size_t b = begin;
+  if (ThreadPool* pool = ThreadPool::current()) {
+    TaskGroup group(*pool, label);
+    for (; b + step < end; b += step) {
+      group.run([&func, b, step] { func(b, b + step); });
+    }
+    func(b, end);
+    group.wait();
+    return;
+  }
+  std::vector<std::thread> workers;
+  workers.reserve(chunks - 1);
+  for (; b + step < end; b += step) {
+    workers.emplace_back(func, b, b + step);
+  }
+  func(b, end);
+  for (std::thread& w : workers) {
+    w.join();
+  }
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef WTT_DEMO_INCLUDE_RENDER_UPLOADER_HPP
+#define WTT_DEMO_INCLUDE_RENDER_UPLOADER_HPP
+
+#include "threaded_gl_buffer_uploader.hpp"
+#include "packed_vertex.hpp"
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class SceneObject;
+
+// GPU-ready data of one mesh, immutable once submitted. Payloads with the
+// same topology share one index array.
+struct RenderPayload {
+  std::vector<PackedVertex> vertices;
+  std::shared_ptr<const std::vector<GLuint>> indices;
+  PositionRange range;
+  std::uint64_t topology = 0;
+};
+
+// Owns the context shared with the view and writes submitted payloads into
+// the back buffer set of the scene on its own thread, so the next job can
+// be computed meanwhile. At most one payload waits; a newer one replaces it,
+// so no more than the uploading and the waiting payload are kept.
+class RenderUploader: public ThreadedGLBufferUploader
+{
+  Q_OBJECT
+public:
+  explicit RenderUploader();
+
+  void obtainSceneInOtherThread(SceneObject* s) { scene_ptr_ = s; }
+
+  // Called from the producing thread, never blocks.
+  void submit(std::shared_ptr<const RenderPayload> payload);
+  void stop();
+
+protected:
+  // Writes elements [begin, end) of a buffer to `data`.
+  using FillSlice = std::function<void(std::size_t begin, std::size_t end, void* data)>;
+
+  // Vertices by id of one part and its indices into them.
+  struct Part {
+    std::vector<GLuint> vertices;
+    std::vector<GLuint> indices;
+  };
+
+  void run() override;
+  void upload(const RenderPayload& payload);
+  void splitParts(const RenderPayload& payload);
+  void writeVbo(std::size_t count, std::size_t size, unsigned int vbo, const FillSlice& fill);
+
+  SceneObject* scene_ptr_;
+  QMutex mutex_;
+  QWaitCondition changed_;
+  std::shared_ptr<const RenderPayload> pending_;
+  bool stopping_;
+
+  // Topology of the index buffers in each buffer set of the scene.
+  bool set_valid_[2] = {false, false};
+  std::uint64_t set_topology_[2] = {0, 0};
+  // Parts of the last topology, empty when it fits one part.
+  std::vector<Part> parts_;
+  bool parts_valid_ = false;
+  std::uint64_t parts_topology_ = 0;
+};
+
+#endif
@@ -2,6 +2,10 @@
 #define WTT_DEMO_INCLUDE_SCENE_OBJECT_HPP
 
 #include <QOpenGLFunctions>
+#include <QVector3D>
+
+#include <cstddef>
+#include <vector>
 class QOpenGLShaderProgram;
 
 class SceneObject: public QObject, public QOpenGLFunctions
@@ -27,16 +31,41 @@ public:
   virtual void rotate(float angle, const QVector3D& vector) = 0;
   virtual void rotate(const QQuaternion& q) = 0;
 
-  virtual void allocateVboData(int count,
+  // Sizes and offsets are in bytes.
+  virtual void allocateVboData(std::size_t count,
                                unsigned int vbo) = 0;
-  virtual void updateVboData(int offset,
+  virtual void updateVboData(std::size_t offset,
                              const void* data,
-                             int count,
+                             std::size_t count,
                              unsigned int vbo) = 0;
 
+  // Maps a range of an allocated `vbo` for writing, null if the driver
+  // refuses. unmapVboData() returns false if the data was lost.
+  virtual void* mapVboData(std::size_t offset, std::size_t count, unsigned int vbo) = 0;
+  virtual bool unmapVboData(unsigned int vbo) = 0;
+
   virtual void setPrimitiveSize(std::size_t size) = 0;
   virtual std::size_t primitiveSize() const = 0;
 
+  // Packed positions are fractions of this box, see PackedVertex.
+  virtual void setPositionRange(const QVector3D& origin, const QVector3D& extent) = 0;
+
+  // In indexed mode the primitive size counts indices into shared vertices.
+  virtual void setIndexed(bool on) = 0;
+  virtual bool indexed() const = 0;
+
+  // Indexed meshes are drawn in parts, each with its own vertices and
+  // indices into them; `sizes` counts the indices of each part.
+  virtual void setPartSizes(const std::vector<std::size_t>& sizes) = 0;
+
+  // Uploads and the setters above write a back buffer set that replaces the
+  // drawn one once the GPU has finished with them. Both calls are made with
+  // the uploading context current; beginUpload() returns the set written.
+  virtual int beginUpload() = 0;
+  virtual void endUpload() = 0;
+  // True while a finished upload waits to be swapped in by render().
+  virtual bool uploadPending() = 0;
+
 protected:
   QOpenGLShaderProgram* glsl_program_;
 };
@@ -0,0 +1,79 @@
+#ifndef WTT_DEMO_INCLUDE_SEMI_REGULAR_MESH_HPP
+#define WTT_DEMO_INCLUDE_SEMI_REGULAR_MESH_HPP
+
+#include "custom_mesh_types.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// A mesh with `level` levels of subdivision connectivity stored as patches.
+// Every base triangle (c0, c1, c2) becomes a regular grid of resolution
+// R = 2^level whose node (i, j), i + j <= R, sits at
+//
+//   c0 + i / R * (c1 - c0) + j / R * (c2 - c0)
+//
+// and node (l, i, j) of level l is node (i, j) scaled by 2^(level - l).
+// Positions are one flat array per coordinate, laid out as
+//
+//   [ base vertices | R - 1 nodes per base edge | interior nodes per patch ]
+//
+// so patches share their corner and edge strips, and inside a patch the
+// neighbours of a node are fixed offsets. The storage is about 28 bytes per
+// vertex plus a small table per base triangle.
+class SemiRegularMesh {
+public:
+  // Recovers the patches of `mesh` by peeling `level` levels of 1-to-4
+  // splits off its connectivity. Fails unless the vertex ids are a
+  // permutation of [0, n) and the connectivity is that of `level` splits.
+  bool fromMesh(const Mesh& mesh, int level);
+  // Builds a Polyhedron with the vertex ids and orientation of the mesh the
+  // patches came from; the other MeshVertex fields are left at 0.
+  bool toMesh(Mesh& mesh) const;
+  void clear();
+
+  int level() const { return level_; }
+  int resolution() const { return 1 << level_; }
+  std::size_t patchCount() const { return patches_.size(); }
+  std::size_t baseVertexCount() const { return base_vertices_; }
+  std::size_t edgeCount() const { return edges_; }
+  std::size_t vertexCount() const { return x_.size(); }
+
+  // Storage index of node (i, j) of `patch` at the finest level.
+  std::size_t node(std::size_t patch, int i, int j) const;
+  std::size_t node(std::size_t patch, int l, int i, int j) const {
+    return node(patch, i << (level_ - l), j << (level_ - l));
+  }
+
+  double* x() { return x_.data(); }
+  double* y() { return y_.data(); }
+  double* z() { return z_.data(); }
+  const double* x() const { return x_.data(); }
+  const double* y() const { return y_.data(); }
+  const double* z() const { return z_.data(); }
+  // Id of the source mesh vertex behind each storage index.
+  const std::vector<std::uint32_t>& vertexIds() const { return ids_; }
+
+  std::size_t memoryBytes() const;
+
+private:
+  struct Patch {
+    std::uint32_t corners[3];
+    // Base edges c0-c1, c1-c2 and c0-c2, and whether each runs in that
+    // direction in storage.
+    std::uint32_t edges[3];
+    bool forward[3];
+  };
+
+  std::size_t edgeNode(const Patch& p, int e, int t) const;
+
+  int level_ = 0;
+  std::size_t base_vertices_ = 0;
+  std::size_t edges_ = 0;
+  std::vector<Patch> patches_;
+  std::vector<double> x_;
+  std::vector<double> y_;
+  std::vector<double> z_;
+  std::vector<std::uint32_t> ids_;
+};
+
+#endif
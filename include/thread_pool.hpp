@@ -0,0 +1,106 @@
+#ifndef WTT_DEMO_INCLUDE_THREAD_POOL_HPP
+#define WTT_DEMO_INCLUDE_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+// Work-stealing pool. Every worker owns a deque: it pushes and pops forked
+// tasks at the back, idle workers steal from the front of the others.
+// Threads outside the pool share one more deque. Whoever waits on a group
+// runs queued tasks meanwhile, so fork/join nests without deadlocking.
+class ThreadPool {
+public:
+  struct TaskStats {
+    std::uint64_t count = 0;
+    std::int64_t nsecs = 0;
+  };
+
+  explicit ThreadPool(std::size_t workers);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Restarts the workers. Only for the thread that runs the pool's task
+  // groups, between them.
+  void setWorkerCount(std::size_t workers);
+  std::size_t workerCount() const { return workers_.size(); }
+
+  // The pool parallelFor() runs on for the calling thread, null to spawn
+  // threads per call. Set per thread; pool workers default to their pool.
+  static ThreadPool* current();
+  static void setCurrent(ThreadPool* pool);
+
+  // Count and run time of finished tasks per label since the last reset.
+  std::map<std::string, TaskStats> stats() const;
+  void resetStats();
+
+private:
+  friend class TaskGroup;
+
+  struct Task {
+    std::function<void()> func;
+    TaskGroup* group;
+    const char* label;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void start(std::size_t workers);
+  void shutdown();
+  void push(Task task);
+  bool runOne();
+  bool pop(std::size_t queue, bool back, Task& task);
+  void execute(Task& task);
+  void work(std::size_t index);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<std::size_t> queued_;
+  std::atomic<std::size_t> next_queue_;
+  bool stopping_;
+  std::mutex sleep_mutex_;
+  // Workers sleep on wake_, waiting threads on idle_ until a task is queued
+  // or their group is done.
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+
+  mutable std::mutex stats_mutex_;
+  std::map<std::string, TaskStats> stats_;
+};
+
+// Tasks forked with run() on a pool, joined by wait().
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool& pool, const char* label = "task")
+    : pool_(pool), label_(label), pending_(0) {}
+  ~TaskGroup() { wait(); }
+
+  void run(std::function<void()> func);
+  // Runs queued tasks of any group until all of this group are done, and
+  // sleeps while there are none to run.
+  void wait();
+
+private:
+  friend class ThreadPool;
+
+  ThreadPool& pool_;
+  const char* label_;
+  std::atomic<std::size_t> pending_;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef WTT_DEMO_INCLUDE_TRANSFORM_CACHE_HPP
+#define WTT_DEMO_INCLUDE_TRANSFORM_CACHE_HPP
+
+#include "level_operator.hpp"
+#include "mesh_data.hpp"
+#include "job_control.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+// Runs FWTs and IWTs through level operators compiled per connectivity.
+//
+// A transform is keyed by the connectivity hash of its input mesh, the
+// direction, the wavelet type and the level count. The first time a key is
+// seen wtlib runs as usual; the second time wtlib still produces the result,
+// and keeps its input and output for compilePending(), which compiles the
+// operator chain and checks it against them. Later transforms with that key
+// are sparse mat-vecs over flat position arrays. Keys whose compilation
+// fails keep running through wtlib.
+//
+// A compiled transform swaps its output into `mesh` and keeps the input as a
+// spare, whose vertices the next transform back to that connectivity writes
+// its positions into; only other outputs are built from a flattened template
+// of the wtlib result. The cache also remembers the connectivity and the
+// vertices of the mesh it returned, so a transform of that mesh reads its
+// positions without flattening or hashing it again. Callers that rebuild the
+// mesh by other means in between call forgetMesh().
+//
+// Both compiled transforms and wtlib runs go one level at a time, report
+// every level to `job` and can be cancelled in between. A cancelled call
+// returns false; a compiled one leaves `mesh` as it was, a wtlib one leaves
+// it partly transformed for the caller to restore, as does a failed wtlib
+// analysis.
+//
+// The operators agree with wtlib only up to rounding, so compiling is off,
+// and every transform runs wtlib, unless built with WTT_COMPILED_TRANSFORMS.
+class TransformCache {
+public:
+  void setCompiling(bool compiling);
+  bool compiling() const { return compiling_; }
+
+  // Same contracts as wtlib's analyze and synthesize on `mesh`.
+  bool analyze(Mesh& mesh, int type, int level, CoefficientStore::Bands& bands,
+               const JobControl* job = nullptr);
+  bool synthesize(Mesh& mesh, int type, int level, const CoefficientStore::Bands& bands,
+                  const JobControl* job = nullptr);
+
+  void forgetMesh();
+
+  // Whether the last analyze() or synthesize() was cancelled.
+  bool cancelled() const { return cancelled_; }
+  // Operators the last synthesize() ran through, null if it ran wtlib.
+  const LevelChain& lastSynthesis() const { return last_synthesis_; }
+
+  // Whether a transform is waiting for compilePending().
+  bool hasPending() const { return pending_ != nullptr; }
+  // Compiles the operators of the last transform that asked for it, which
+  // takes several wtlib runs per level; meant for when nothing else is to
+  // be done. Returns whether operators were compiled. When `job` is
+  // cancelled the key stays uncompiled and its next transform asks again.
+  bool compilePending(const JobControl* job = nullptr);
+
+  void clear();
+  std::size_t size() const { return entries_.size(); }
+  std::size_t memoryBytes() const;
+
+private:
+  using Key = std::tuple<std::uint64_t, int, int, int>;
+
+  struct Entry {
+    LevelChain operators;
+    // Output connectivity and vertex fields, positions are filled per call.
+    MeshData output;
+    std::uint64_t output_hash = 0;
+    bool failed = false;
+    int seen = 0;
+    std::uint64_t used = 0;
+  };
+
+  // A transform compilePending() still has to compile, by its input and
+  // output.
+  struct Pending {
+    Key key;
+    MeshSnapshot input;
+    MeshSnapshot output;
+    CoefficientStore::Bands bands;
+  };
+
+  Entry& lookup(const Key& key);
+  std::uint64_t inputHash(const Mesh& mesh, MeshData& data) const;
+  void readInput(const Mesh& mesh, const MeshData& data, std::vector<double> (&p)[3]) const;
+  void writeOutput(const Entry& entry, std::uint64_t input_hash, const std::vector<double> (&p)[3], Mesh& mesh);
+  bool compileAnalysis(Entry& entry, const Mesh& fine, int type, int level,
+                       const Mesh& coarse, const CoefficientStore::Bands& bands,
+                       const JobControl* job);
+  bool compileSynthesis(Entry& entry, const Mesh& coarse, int type, int level,
+                        const CoefficientStore::Bands& bands, const Mesh& fine,
+                        const JobControl* job);
+
+  std::map<Key, Entry> entries_;
+#ifdef WTT_COMPILED_TRANSFORMS
+  bool compiling_ = true;
+#else
+  bool compiling_ = false;
+#endif
+  std::uint64_t clock_ = 0;
+  bool cancelled_ = false;
+  LevelChain last_synthesis_;
+  std::unique_ptr<Pending> pending_;
+  // The mesh the last compiled transform returned, until forgetMesh().
+  const Mesh* mesh_ = nullptr;
+  std::uint64_t mesh_hash_ = 0;
+  std::vector<Mesh::Vertex_handle> handles_;
+  Mesh spare_;
+  std::uint64_t spare_hash_ = 0;
+  bool has_spare_ = false;
+};
+
+#endif
@@ -2,24 +2,36 @@
 #define WTT_DEMO_INCLUDE_TRIANGLE_MESH_SCENE_HPP
 
 #include "logger.hpp"
+#include "packed_vertex.hpp"
 #include <scene_object.hpp>
 
 #include <QOpenGLBuffer>
 #include <QOpenGLVertexArrayObject>
 #include <QMatrix4x4>
+#include <QMutex>
+#include <QVector3D>
+
+#include <vector>
 
 class TriangleMeshScene: public SceneObject
 {
   Q_OBJECT
 public:
+  // The vertices and indices of part k are vbos partVbo(VERTEX, k) and
+  // partVbo(INDEX, k).
   enum VBO
   {
-    POSITION = 0,
-    VNORMAL = 1,
-    FNORMAL = 2,
-    BARYCENTRIC = 3
+    VERTEX = 0,
+    INDEX = 1
   };
 
+  // Every vertex and index buffer stays within this, below the 1 GiB some
+  // drivers cap a buffer at; larger meshes are split into parts, each one
+  // draw call. It holds a whole number of triangles.
+  static constexpr std::size_t kMaxBufferBytes = std::size_t(3) << 28;
+
+  static unsigned int partVbo(VBO vbo, std::size_t part) { return vbo + 2 * static_cast<unsigned int>(part); }
+
 public:
   explicit TriangleMeshScene(QObject* parent = 0);
   virtual ~TriangleMeshScene();
@@ -33,26 +45,28 @@ public:
 
   virtual QMatrix4x4 modelMat() const;
 
-  virtual void allocateVboData(int count,
+  virtual void allocateVboData(std::size_t count,
                                unsigned int vbo) override;
-  virtual void updateVboData(int offset,
+  virtual void updateVboData(std::size_t offset,
                              const void* data,
-                             int count,
+                             std::size_t count,
                              unsigned int vbo) override;
 
-  virtual void allocatePos(int count);
-  virtual void allocateVNormal(int count);
-  virtual void allocateFNormal(int count);
-  virtual void allocateBC(int count);
-
-  virtual void updatePos(int offset, const void* data, int count);
-  virtual void updateVNormal(int offset, const void* data, int count);
-  virtual void updateFNormal(int offset, const void* data, int count);
-  virtual void updateBC(int offset, const void* data, int count);
+  virtual void* mapVboData(std::size_t offset, std::size_t count, unsigned int vbo) override;
+  virtual bool unmapVboData(unsigned int vbo) override;
 
   virtual void setPrimitiveSize(std::size_t size) override;
   virtual std::size_t primitiveSize() const override;
 
+  virtual void setPositionRange(const QVector3D& origin, const QVector3D& extent) override;
+  virtual void setIndexed(bool on) override;
+  virtual bool indexed() const override;
+  virtual void setPartSizes(const std::vector<std::size_t>& sizes) override;
+
+  virtual int beginUpload() override;
+  virtual void endUpload() override;
+  virtual bool uploadPending() override;
+
   virtual void loadShader();
 
   virtual void renderEdge(bool on) override;
@@ -61,19 +75,36 @@ public:
   virtual void rotate(const QQuaternion& q) override;
 
 protected:
-  QOpenGLVertexArrayObject vao_;
-  QOpenGLBuffer vpos_;
-  QOpenGLBuffer vnormal_;
+  // Everything one upload writes. render() draws the front set while the
+  // uploader fills the back one.
+  struct BufferSet {
+    // Interleaved PackedVertex data and indices, per part.
+    std::vector<QOpenGLBuffer> vertex;
+    std::vector<QOpenGLBuffer> index;
+    std::vector<std::size_t> part_sizes;
+    QVector3D position_origin;
+    QVector3D position_extent = QVector3D(1.0, 1.0, 1.0);
+    bool indexed = false;
+    std::size_t primitive_size = 0;
+  };
 
-  QOpenGLBuffer fnormal_;
-  QOpenGLBuffer vbarycentric_;
+  BufferSet& back() { return sets_[1 - front_]; }
+  QOpenGLBuffer* backBuffer(unsigned int vbo);
+  void swapIfUploaded();
+
+  QOpenGLVertexArrayObject vao_;
+  BufferSet sets_[2];
+  // front_ is only changed by render(), fence_ marks a finished back set;
+  // both are guarded by swap_mutex_.
+  int front_;
+  GLsync fence_;
+  QMutex swap_mutex_;
 
   QMatrix4x4 model_;
   QMatrix4x4 view_;
   QMatrix4x4 proj_;
 
   bool show_edge_;
-  std::size_t tri_size_;
   DebugLogger debug;
   FatalLogger critical;
 };
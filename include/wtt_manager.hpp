@@ -2,23 +2,53 @@
 #define WTT_DEMO_INCLUDE_WTT_MANAGER_HPP
 
 #include "custom_mesh_types.hpp"
-#include "threaded_gl_buffer_uploader.hpp"
+#include "coefficient_store.hpp"
+#include "coefficient_ranking.hpp"
+#include "incremental_synthesis.hpp"
+#include "band_equalizer.hpp"
+#include "transform_cache.hpp"
+#include "render_uploader.hpp"
+#include "thread_pool.hpp"
+#include "job_control.hpp"
+#include "command_queue.hpp"
+#include "operation_history.hpp"
+#include "analysis_memo.hpp"
+#include "packed_vertex.hpp"
+#include "mesh_data.hpp"
 #include "logger.hpp"
 
 #include <QThread>
+#include <QVector>
+#include <QVector3D>
 #include <QOpenGLFunctions>
 
+#include <memory>
+
 class SceneObject;
-class QOpenGLContext;
-class QOffscreenSurface;
 
-class WTTManager: public ThreadedGLBufferUploader{
+// Runs the mesh and wavelet jobs on its own thread and hands render
+// payloads to a RenderUploader thread.
+class WTTManager: public QThread{
   Q_OBJECT
 public:
   enum WTType {
     LOOP = 0,
     BUTTERFLY = 1
   };
+  enum CommandKind {
+    LOAD = 0,
+    RESET = 1,
+    FWT = 2,
+    IWT = 3,
+    COMPRESS = 4,
+    DENOISE = 5,
+    GAINS = 6,
+    UNDO = 7,
+    REDO = 8,
+    COMPILE = 9,
+    GAINS_DONE = 10,
+    WORKERS = 11
+  };
   using Halfedge = typename Mesh::Halfedge_const_handle;
   using Vertex = typename Mesh::Vertex_const_handle;
   using Facet = typename Mesh::Facet_const_handle;
@@ -26,7 +56,22 @@ public:
   using Vertex_handle = typename Mesh::Vertex_handle;
   using Vertex_const_handle = typename Mesh::Vertex_const_handle;
   explicit WTTManager();
-  void obtainSceneInOtherThread(SceneObject* s) { scene_ptr_ = s;}
+  ~WTTManager();
+  void obtainSceneInOtherThread(SceneObject* s) { uploader_->obtainSceneInOtherThread(s); }
+  RenderUploader* uploader() { return uploader_; }
+  // Safe from any thread: sets the pool threads besides the manager thread
+  // once the running job is done.
+  void setWorkerCount(std::size_t workers);
+  // Safe from any thread: queues `command`, e.g. a call of one of the slots
+  // below, to run on the manager thread. Compress, denoise and gain
+  // commands replace a pending one of their kind, and so does a load, which
+  // also preempts a running load.
+  void post(int kind, CommandQueue::Command command);
+  // Safe from any thread. Drops the pending loads and transforms, and stops
+  // a running one at its next check; it then leaves the meshes and
+  // coefficients as they were. Once a job has started changing them it
+  // runs to the end.
+  void cancelJob();
 
 public slots:
   void onLoadMesh(QString filename);
@@ -39,12 +84,19 @@ public slots:
 
   void onCompress(double perc);
   void onDenoise(int level);
+  void onSetBandGains(QVector<double> gains);
+  // Ends the gain edit that following onSetBandGains() calls would join.
+  void onGainsDone();
+  // Step through the transforms, compressions, denoisings and gain changes
+  // since the last load or reset.
+  void onUndo();
+  void onRedo();
   void prepareBuffer(const Mesh& mesh);
+  void updateGeometry(const Mesh& mesh);
+
+protected slots:
+  void runCommands();
 
-  void uploadBuffer(const std::vector<GLfloat>& vpos,
-                    const std::vector<GLfloat>& vnormals,
-                    const std::vector<GLfloat>& fnormals,
-                    const std::vector<GLfloat>& vbcs);
 signals:
   void meshLoaded(BoundingBox bbox, QString err);
   void meshReset();
@@ -53,14 +105,88 @@ signals:
   void iwtDone(bool, int, QString msg);
   void compressDone(QString msg);
   void denoiseDone(QString msg);
+  // After an undo or redo that did not end in one of the signals above:
+  // the number of bands and their gains.
+  void historyStepped(int levels, QVector<double> gains);
 
   void updateMeshInfo(int vsize, int fsize);
+  // Emitted from the job's threads with what it is doing, e.g. "Parsing 40%".
+  void progress(QString text);
+  // Emitted when the job enters or leaves a step that ignores cancelJob().
+  void cancellable(bool cancellable);
+  void jobCancelled();
 
 protected:
-  SceneObject* scene_ptr_;
-  Mesh mesh_origin_;
+  bool readOFFMesh(const QString& filename, MeshData& data, QString& err);
+  bool buildOFFMesh(MeshData& data, QString& err);
+  bool loadBinaryMesh(const QString& filename, QString& err);
+  void submitRender(const Mesh& mesh, std::uint64_t topology, const JobControl* job);
+  BoundingBox computeBBox(const std::vector<Vertex>& vertices);
+  PositionRange positionRange(const std::vector<Vertex>& vertices);
+  void fillVertices(const std::vector<Vertex>& vertices,
+                    std::size_t begin,
+                    std::size_t end,
+                    const PositionRange& range,
+                    PackedVertex* packed);
+  void fillIndices(const std::vector<Facet>& facets,
+                   std::size_t begin,
+                   std::size_t end,
+                   GLuint* indices);
+  void clearCoefficients();
+  void rebuildCoefficients();
+  std::vector<double> bandGains() const;
+  bool buildEqualizer();
+  void refreshPreview();
+  void updateSynthesis();
+  void logTaskStats(const char* job);
+  void trackPercent(const QString& stage);
+  void trackSteps(const QString& stage);
+  void reportCancelled();
+  bool deferRender();
+  void compileTransforms();
+  OperationParams params() const;
+  void setParams(const OperationParams& params);
+  MeshSnapshot snapshot() const;
+  TransformState transformState(MeshSnapshot mesh) const;
+  void restoreState(TransformState& state, const OperationParams& params);
+  void recordEdit(int kind, const OperationParams& before, const CoefficientStore& previous);
+  void showEdit(const OperationParams& from, const OperationParams& to);
+  void emitHistoryStepped();
+
+  ThreadPool pool_;
+  JobControl job_;
+  CommandQueue commands_;
+  // Set when a superseded command skipped its upload.
+  bool render_deferred_ = false;
+  RenderUploader* uploader_;
+  // Index array and triangleHash() of the last submitted mesh.
+  std::shared_ptr<const std::vector<GLuint>> indices_;
+  std::uint64_t topology_ = 0;
+  // The mesh as loaded; mesh_for_wt_ is rebuilt from it on reset.
+  MeshSnapshot origin_;
   Mesh mesh_for_wt_;
-  std::vector<std::vector<Vector3>> coefs_;
+  // Whether mesh_for_wt_ may differ from origin_.
+  bool modified_ = false;
+  std::uint64_t origin_hash_ = 0;
+  AnalysisMemo analyses_;
+  CoefficientStore coefs_;
+  CoefficientStore fwt_coefs_;
+  CoefficientRanking ranking_;
+  int fwt_type_ = WTType::LOOP;
+  int fwt_level_ = 0;
+  double compress_perc_ = 100.0;
+  int denoise_level_ = -1;
+  std::vector<double> band_gains_;
+  TransformCache transforms_;
+  IncrementalSynthesis synthesis_;
+  BandEqualizer equalizer_;
+  bool preview_ = false;
+  int synthesis_type_ = WTType::LOOP;
+  OperationHistory history_;
+  // Set while onRedo() runs a transform again.
+  bool redoing_ = false;
+  // Whether the last gain edit is still being dragged.
+  bool gains_open_ = false;
   DebugLogger debug;
   FatalLogger critical;
 };
@@ -172,6 +172,7 @@ void ActionPanel::onIWTDone(bool succ) {
   //   ui_ptr_->compress_button->setDisabled(true);
   //   ui_ptr_->denoise_button->setDisabled(true);
   // }
-  ui_ptr_->denoise_button->setEnabled(false);
-  ui_ptr_->compress_button->setEnabled(false);
+  // The reconstruction follows later compression and denoising directly.
+  ui_ptr_->denoise_button->setEnabled(succ);
+  ui_ptr_->compress_button->setEnabled(succ);
 }
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "analysis_memo.hpp"
+
+#include <algorithm>
+
+void AnalysisMemo::setBudget(std::size_t bytes) {
+  budget_ = bytes;
+  evict();
+}
+
+const AnalysisMemo::Result* AnalysisMemo::find(std::uint64_t hash, int type, int level) {
+  auto it = entries_.find(Key(hash, type, level));
+  if (it == entries_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  it->second.used = ++clock_;
+  return &it->second.result;
+}
+
+// Checks the size first, so an oversized result does not evict the rest.
+void AnalysisMemo::insert(std::uint64_t hash, int type, int level, Result result) {
+  std::size_t bytes = result.coarse.memoryBytes() + result.coefs.memoryBytes() +
+                      sizeof(std::uint32_t) * result.ranking.size();
+  if (bytes > budget_) {
+    return;
+  }
+  Entry& entry = entries_[Key(hash, type, level)];
+  bytes_ -= entry.bytes;
+  entry.bytes = bytes;
+  entry.result = std::move(result);
+  entry.used = ++clock_;
+  bytes_ += entry.bytes;
+  evict();
+}
+
+void AnalysisMemo::clear() {
+  entries_.clear();
+  bytes_ = 0;
+}
+
+void AnalysisMemo::evict() {
+  while (bytes_ > budget_ && !entries_.empty()) {
+    auto oldest = std::min_element(entries_.begin(), entries_.end(), [](const auto& a, const auto& b) {
+      return a.second.used < b.second.used;
+    });
+    bytes_ -= oldest->second.bytes;
+    entries_.erase(oldest);
+  }
+}
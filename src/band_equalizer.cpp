@@ -0,0 +1,105 @@
+#include "band_equalizer.hpp"
+#include "parallel_for.hpp"
+
+namespace {
+
+constexpr std::size_t kMinChunkVertices = 1 << 14;
+
+using Point = typename Mesh::Traits::Point_3;
+using Vector3 = typename Mesh::Traits::Vector_3;
+
+}  // namespace
+
+bool BandEqualizer::build(const Mesh& coarse, const CoefficientStore& coefs, int level, const Synthesize& synthesize) {
+  clear();
+  if (level <= 0 || coefs.bandCount() < std::size_t(level)) {
+    return false;
+  }
+
+  // Vertices are matched across the syntheses by iteration order, which
+  // only depends on the coarse connectivity.
+  auto read = [](const Mesh& mesh, Field& field) {
+    field.x.clear();
+    field.y.clear();
+    field.z.clear();
+    field.x.reserve(mesh.size_of_vertices());
+    field.y.reserve(mesh.size_of_vertices());
+    field.z.reserve(mesh.size_of_vertices());
+    for (auto v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+      field.x.push_back(v->point().x());
+      field.y.push_back(v->point().y());
+      field.z.push_back(v->point().z());
+    }
+  };
+
+  CoefficientStore::Bands bands(level);
+  for (int b = 0; b < level; ++b) {
+    bands[b].assign(coefs.bandSize(b), Vector3(0.0, 0.0, 0.0));
+  }
+  mesh_ = coarse;
+  synthesize(mesh_, bands, level);
+  read(mesh_, base_);
+
+  Mesh zero(coarse);
+  for (auto v = zero.vertices_begin(); v != zero.vertices_end(); ++v) {
+    v->point() = Point(0.0, 0.0, 0.0);
+  }
+  fields_.resize(level);
+  for (int b = 0; b < level; ++b) {
+    for (std::size_t i = 0; i < coefs.bandSize(b); ++i) {
+      bands[b][i] = coefs.at(coefs.bandBegin(b) + i);
+    }
+    Mesh displaced(zero);
+    synthesize(displaced, bands, level);
+    read(displaced, fields_[b]);
+    bands[b].assign(coefs.bandSize(b), Vector3(0.0, 0.0, 0.0));
+    if (fields_[b].x.size() != base_.x.size()) {
+      clear();
+      return false;
+    }
+  }
+
+  handles_.reserve(mesh_.size_of_vertices());
+  for (Mesh::Vertex_handle v = mesh_.vertices_begin(); v != mesh_.vertices_end(); ++v) {
+    handles_.push_back(v);
+  }
+  return true;
+}
+
+void BandEqualizer::clear() {
+  mesh_.clear();
+  handles_.clear();
+  base_ = Field();
+  fields_.clear();
+}
+
+void BandEqualizer::apply(const std::vector<double>& gains) {
+  std::vector<std::pair<double, const Field*>> terms;
+  for (std::size_t b = 0; b < fields_.size(); ++b) {
+    double g = b < gains.size() ? gains[b] : 1.0;
+    if (g != 0.0) {
+      terms.emplace_back(g, &fields_[b]);
+    }
+  }
+  parallelFor(0, handles_.size(), kMinChunkVertices, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      double x = base_.x[i];
+      double y = base_.y[i];
+      double z = base_.z[i];
+      for (const auto& t : terms) {
+        x += t.first * t.second->x[i];
+        y += t.first * t.second->y[i];
+        z += t.first * t.second->z[i];
+      }
+      handles_[i]->point() = Point(x, y, z);
+    }
+  }, "BandEqualizer::apply");
+}
+
+std::size_t BandEqualizer::memoryBytes() const {
+  std::size_t bytes = 3 * sizeof(double) * base_.x.capacity() + sizeof(Mesh::Vertex_handle) * handles_.capacity();
+  for (const Field& f : fields_) {
+    bytes += 3 * sizeof(double) * f.x.capacity();
+  }
+  return bytes;
+}
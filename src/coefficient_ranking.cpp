@@ -0,0 +1,127 @@
+#include "coefficient_ranking.hpp"
+#include "parallel_for.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+
+// Below this many items per chunk the threads cost more than they save.
+constexpr std::size_t kMinChunkItems = 1 << 16;
+constexpr std::size_t kRadixBits = 8;
+constexpr std::size_t kBuckets = 1 << kRadixBits;
+
+template <class Scalar> struct RadixKey;
+template <> struct RadixKey<float> { using Type = std::uint32_t; };
+template <> struct RadixKey<double> { using Type = std::uint64_t; };
+
+using Key = RadixKey<CoefficientScalar>::Type;
+using Histogram = std::array<std::size_t, kBuckets>;
+
+// Squared norms are never negative, so their IEEE bit patterns order the same
+// way the values do. Inverting the bits turns the ascending sort below into a
+// descending one.
+inline Key descendingKey(CoefficientScalar v) {
+  Key bits;
+  std::memcpy(&bits, &v, sizeof(bits));
+  return ~bits;
+}
+
+inline std::size_t digit(Key key, std::size_t pass) {
+  return (key >> (pass * kRadixBits)) & (kBuckets - 1);
+}
+
+// Stable LSD radix sort of (key, index) pairs. Every pass histograms fixed
+// contiguous chunks in parallel, turns the histograms into per-chunk write
+// offsets and scatters each chunk in order, so the result does not depend on
+// the number of threads. Passes on which all keys share a digit are skipped.
+void radixSort(std::vector<Key>& keys, std::vector<std::uint32_t>& order) {
+  std::size_t n = keys.size();
+  std::size_t chunk_count = std::max<std::size_t>(1, std::min(parallelWorkerCount(), n / kMinChunkItems));
+  auto chunkBegin = [n, chunk_count](std::size_t c) { return n * c / chunk_count; };
+
+  std::vector<Key> keys_tmp(n);
+  std::vector<std::uint32_t> order_tmp(n);
+  std::vector<Histogram> hists(chunk_count);
+  for (std::size_t pass = 0; pass < sizeof(Key) * 8 / kRadixBits; ++pass) {
+    parallelFor(0, chunk_count, 1, [&](std::size_t b, std::size_t e) {
+      for (std::size_t c = b; c < e; ++c) {
+        Histogram& h = hists[c];
+        h.fill(0);
+        for (std::size_t i = chunkBegin(c); i < chunkBegin(c + 1); ++i) {
+          ++h[digit(keys[i], pass)];
+        }
+      }
+    });
+
+    bool trivial = false;
+    std::size_t offset = 0;
+    for (std::size_t d = 0; d < kBuckets; ++d) {
+      std::size_t bucket = 0;
+      for (Histogram& h : hists) {
+        std::size_t count = h[d];
+        h[d] = offset + bucket;
+        bucket += count;
+      }
+      trivial = trivial || bucket == n;
+      offset += bucket;
+    }
+    if (trivial) {
+      continue;
+    }
+
+    parallelFor(0, chunk_count, 1, [&](std::size_t b, std::size_t e) {
+      for (std::size_t c = b; c < e; ++c) {
+        Histogram& h = hists[c];
+        for (std::size_t i = chunkBegin(c); i < chunkBegin(c + 1); ++i) {
+          std::size_t dst = h[digit(keys[i], pass)]++;
+          keys_tmp[dst] = keys[i];
+          order_tmp[dst] = order[i];
+        }
+      }
+    });
+    keys.swap(keys_tmp);
+    order.swap(order_tmp);
+  }
+}
+
+}  // namespace
+
+void CoefficientRanking::build(const CoefficientStore& coefs) {
+  std::size_t n = coefs.size();
+  std::vector<Key> keys(n);
+  order_.resize(n);
+  parallelFor(0, n, kMinChunkItems, [&](std::size_t b, std::size_t e) {
+    for (std::size_t i = b; i < e; ++i) {
+      keys[i] = descendingKey(coefs.squaredNorm(i));
+      order_[i] = static_cast<std::uint32_t>(i);
+    }
+  }, "CoefficientRanking::build");
+  radixSort(keys, order_);
+}
+
+void CoefficientRanking::clear() {
+  order_.clear();
+  order_.shrink_to_fit();
+}
+
+std::size_t CoefficientRanking::keepCount(double perc) const {
+  return std::min(order_.size(), std::size_t(std::max(0.0, order_.size() * perc / 100.0)));
+}
+
+void CoefficientRanking::zeroTail(CoefficientStore& coefs, std::size_t keep) const {
+  using Scalar = CoefficientStore::Scalar;
+  Scalar* x = coefs.x();
+  Scalar* y = coefs.y();
+  Scalar* z = coefs.z();
+  const std::uint32_t* order = order_.data();
+  parallelFor(std::min(keep, order_.size()), order_.size(), kMinChunkItems, [=](std::size_t b, std::size_t e) {
+    for (std::size_t i = b; i < e; ++i) {
+      std::uint32_t c = order[i];
+      x[c] = Scalar(0);
+      y[c] = Scalar(0);
+      z[c] = Scalar(0);
+    }
+  });
+}
@@ -0,0 +1,103 @@
+#include "coefficient_store.hpp"
+
+#include <algorithm>
+
+void CoefficientStore::fromBands(const Bands& bands) {
+  offsets_.assign(1, 0);
+  for (const std::vector<Vector3>& band : bands) {
+    offsets_.push_back(offsets_.back() + band.size());
+  }
+  x_.resize(offsets_.back());
+  y_.resize(offsets_.back());
+  z_.resize(offsets_.back());
+  std::size_t i = 0;
+  for (const std::vector<Vector3>& band : bands) {
+    for (const Vector3& v : band) {
+      x_[i] = static_cast<Scalar>(v.x());
+      y_[i] = static_cast<Scalar>(v.y());
+      z_[i] = static_cast<Scalar>(v.z());
+      ++i;
+    }
+  }
+}
+
+void CoefficientStore::toBands(Bands& bands) const {
+  bands.resize(bandCount());
+  for (std::size_t b = 0; b < bandCount(); ++b) {
+    std::vector<Vector3>& band = bands[b];
+    band.clear();
+    band.reserve(bandSize(b));
+    for (std::size_t i = bandBegin(b); i < bandEnd(b); ++i) {
+      band.emplace_back(x_[i], y_[i], z_[i]);
+    }
+  }
+}
+
+bool CoefficientStore::resizeBands(const std::vector<std::size_t>& sizes) {
+  bool padded = sizes.size() > bandCount();
+  std::vector<std::size_t> offsets(1, 0);
+  for (std::size_t s : sizes) {
+    offsets.push_back(offsets.back() + s);
+  }
+  for (std::size_t b = 0; b < std::min(sizes.size(), bandCount()); ++b) {
+    padded = padded || sizes[b] != bandSize(b);
+  }
+  if (!padded && sizes.size() == bandCount()) {
+    return false;
+  }
+
+  std::vector<Scalar> x(offsets.back(), Scalar(0));
+  std::vector<Scalar> y(offsets.back(), Scalar(0));
+  std::vector<Scalar> z(offsets.back(), Scalar(0));
+  for (std::size_t b = 0; b < std::min(sizes.size(), bandCount()); ++b) {
+    std::size_t n = std::min(sizes[b], bandSize(b));
+    std::copy_n(x_.begin() + bandBegin(b), n, x.begin() + offsets[b]);
+    std::copy_n(y_.begin() + bandBegin(b), n, y.begin() + offsets[b]);
+    std::copy_n(z_.begin() + bandBegin(b), n, z.begin() + offsets[b]);
+  }
+  x_.swap(x);
+  y_.swap(y);
+  z_.swap(z);
+  offsets_.swap(offsets);
+  return padded;
+}
+
+bool CoefficientStore::hasBandSizes(const std::vector<std::size_t>& sizes) const {
+  if (sizes.size() != bandCount()) {
+    return false;
+  }
+  for (std::size_t b = 0; b < sizes.size(); ++b) {
+    if (sizes[b] != bandSize(b)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CoefficientStore::clear() {
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  x_.shrink_to_fit();
+  y_.shrink_to_fit();
+  z_.shrink_to_fit();
+  offsets_.assign(1, 0);
+}
+
+std::size_t CoefficientStore::memoryBytes() const {
+  return 3 * sizeof(Scalar) * x_.capacity() + sizeof(std::size_t) * offsets_.capacity();
+}
+
+void CoefficientStore::setZero(std::size_t begin, std::size_t end) {
+  std::fill(x_.begin() + begin, x_.begin() + end, Scalar(0));
+  std::fill(y_.begin() + begin, y_.begin() + end, Scalar(0));
+  std::fill(z_.begin() + begin, z_.begin() + end, Scalar(0));
+}
+
+void CoefficientStore::scale(std::size_t begin, std::size_t end, Scalar factor) {
+  for (std::size_t i = begin; i < end; ++i) {
+    x_[i] *= factor;
+    y_[i] *= factor;
+    z_[i] *= factor;
+  }
+}
@@ -0,0 +1,79 @@
+#include "command_queue.hpp"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+void CommandQueue::setPolicy(int kind, int policy) {
+  QMutexLocker lock(&mutex_);
+  policies_[kind] = policy;
+}
+
+int CommandQueue::policy(int kind) const {
+  auto it = policies_.find(kind);
+  return it == policies_.end() ? 0 : it->second;
+}
+
+bool CommandQueue::post(int kind, Command command) {
+  QMutexLocker lock(&mutex_);
+  int p = policy(kind);
+  if (p & COALESCE) {
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                  [kind](const Entry& e) { return e.kind == kind; }),
+                   entries_.end());
+  }
+  if ((p & PREEMPT) && running_ == kind) {
+    job_.cancel();
+  }
+  if (running_ >= 0 && running_ != kind && (policy(running_) & YIELD)) {
+    job_.cancel();
+  }
+  entries_.push_back(Entry{kind, std::move(command)});
+  bool wake = !scheduled_;
+  scheduled_ = true;
+  return wake;
+}
+
+bool CommandQueue::take(int& kind, Command& command) {
+  QMutexLocker lock(&mutex_);
+  if (entries_.empty()) {
+    running_ = -1;
+    scheduled_ = false;
+    return false;
+  }
+  kind = entries_.front().kind;
+  command = std::move(entries_.front().command);
+  entries_.pop_front();
+  running_ = kind;
+  job_.reset();
+  return true;
+}
+
+std::size_t CommandQueue::cancel() {
+  QMutexLocker lock(&mutex_);
+  std::size_t before = entries_.size();
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                [this](const Entry& e) { return policy(e.kind) & CANCEL; }),
+                 entries_.end());
+  if (running_ >= 0 && (policy(running_) & CANCEL)) {
+    job_.cancel();
+  }
+  return before - entries_.size();
+}
+
+int CommandQueue::running() const {
+  QMutexLocker lock(&mutex_);
+  return running_;
+}
+
+bool CommandQueue::pending(int kind) const {
+  QMutexLocker lock(&mutex_);
+  return std::any_of(entries_.begin(), entries_.end(), [kind](const Entry& e) { return e.kind == kind; });
+}
+
+bool CommandQueue::superseded() const {
+  QMutexLocker lock(&mutex_);
+  int kind = running_;
+  return kind >= 0 && (policy(kind) & COALESCE) &&
+         std::any_of(entries_.begin(), entries_.end(), [kind](const Entry& e) { return e.kind == kind; });
+}
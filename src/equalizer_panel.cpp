@@ -0,0 +1,98 @@
+#include "equalizer_panel.hpp"
+
+#include <QDebug>
+#include <QFile>
+#include <QLabel>
+#include <QSlider>
+#include <QBoxLayout>
+#include <QScreen>
+#include <QApplication>
+
+EqualizerPanel::EqualizerPanel(QWidget* parent):
+QWidget(parent),
+sliders_layout_(new QHBoxLayout())
+{
+  QFile qss_file(":/qss/equalizer_panel.qss");
+  if (qss_file.open(QFile::ReadOnly)) {
+    this->setStyleSheet(QString(qss_file.readAll()));
+  } else {
+    qCritical() << "[GUI][EqualizerPanel] Error applying qss: " << qss_file.fileName();
+  }
+
+  QVBoxLayout* main_layout = new QVBoxLayout(this);
+  QHBoxLayout* title_layout = new QHBoxLayout();
+  QLabel* icon = new QLabel(this);
+  icon->setPixmap(QPixmap(":/images/equalizer.png"));
+  icon->setScaledContents(true);
+  qreal scale = qApp->primaryScreen()->logicalDotsPerInch() / 96.0;
+  icon->setFixedSize(QSize(24, 24) * scale);
+  title_layout->addWidget(icon);
+  title_layout->addWidget(new QLabel("Band gains", this));
+  main_layout->addLayout(title_layout);
+  main_layout->addLayout(sliders_layout_);
+  this->setLayout(main_layout);
+}
+
+EqualizerPanel::~EqualizerPanel() {}
+
+QVector<double> EqualizerPanel::gains() const {
+  QVector<double> g;
+  for (QSlider* s : sliders_) {
+    g.push_back(s->value() / 100.0);
+  }
+  return g;
+}
+
+void EqualizerPanel::setBandCount(int count) {
+  while (sliders_.size() > count) {
+    delete sliders_layout_->takeAt(sliders_.size() - 1);
+    delete sliders_.takeLast();
+    delete labels_.takeLast();
+  }
+  qreal scale = qApp->primaryScreen()->logicalDotsPerInch() / 96.0;
+  while (sliders_.size() < count) {
+    QVBoxLayout* band_layout = new QVBoxLayout();
+    QSlider* slider = new QSlider(Qt::Vertical, this);
+    slider->setRange(0, 200);
+    slider->setValue(100);
+    slider->setMinimumHeight(120 * scale);
+    QLabel* label = new QLabel(QString::number(sliders_.size()), this);
+    label->setAlignment(Qt::AlignCenter);
+    band_layout->addWidget(slider, 0, Qt::AlignHCenter);
+    band_layout->addWidget(label);
+    sliders_layout_->addLayout(band_layout);
+    connect(slider, &QSlider::valueChanged, this, &EqualizerPanel::onSliderMoved);
+    connect(slider, &QSlider::sliderReleased, this, &EqualizerPanel::gainsCommitted);
+    sliders_.push_back(slider);
+    labels_.push_back(label);
+  }
+  this->adjustSize();
+}
+
+void EqualizerPanel::resetGains() {
+  for (QSlider* s : sliders_) {
+    s->blockSignals(true);
+    s->setValue(100);
+    s->blockSignals(false);
+  }
+}
+
+void EqualizerPanel::setGains(QVector<double> gains) {
+  for (int i = 0; i < sliders_.size(); ++i) {
+    sliders_[i]->blockSignals(true);
+    sliders_[i]->setValue(i < gains.size() ? qRound(gains[i] * 100.0) : 100);
+    sliders_[i]->setToolTip(QString::number(sliders_[i]->value()) + "%");
+    sliders_[i]->blockSignals(false);
+  }
+}
+
+void EqualizerPanel::onSliderMoved() {
+  for (int i = 0; i < sliders_.size(); ++i) {
+    sliders_[i]->setToolTip(QString::number(sliders_[i]->value()) + "%");
+  }
+  emit gainsChanged(gains());
+  QSlider* slider = qobject_cast<QSlider*>(sender());
+  if (slider && !slider->isSliderDown()) {
+    emit gainsCommitted();
+  }
+}
@@ -0,0 +1,264 @@
+#include "incremental_synthesis.hpp"
+#include "parallel_for.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr double kVerifyTolerance = 1e-9;
+// Once more than 1 / kDenseFraction of the coefficients changed, the whole
+// operator chain is cheaper than the sparse propagation.
+constexpr std::size_t kDenseFraction = 8;
+constexpr std::size_t kMinChunkVertices = 1 << 14;
+
+using Point = typename Mesh::Traits::Point_3;
+
+}  // namespace
+
+void IncrementalSynthesis::record(MeshSnapshot coarse, int level, const CoefficientStore& coefs, const Synthesize& synthesize) {
+  clear();
+  coarse_ = std::move(coarse);
+  level_ = level;
+  applied_ = coefs;
+  synthesize_ = synthesize;
+}
+
+void IncrementalSynthesis::share(const LevelChain& operators) {
+  if (recorded() && !compiled_ && operators && operators->size() == std::size_t(level_)) {
+    operators_ = operators;
+  }
+}
+
+void IncrementalSynthesis::clear() {
+  coarse_ = MeshSnapshot();
+  level_ = 0;
+  applied_.clear();
+  synthesize_ = Synthesize();
+  compiled_ = false;
+  failed_ = false;
+  operators_.reset();
+  handles_.clear();
+  last_changed_ = 0;
+  last_moved_ = 0;
+}
+
+bool IncrementalSynthesis::update(const CoefficientStore& coefs, Mesh& mesh) {
+  last_changed_ = 0;
+  last_moved_ = 0;
+  if (!recorded() || coefs.bandCount() < std::size_t(level_) || applied_.bandCount() < std::size_t(level_)) {
+    return false;
+  }
+  for (int b = 0; b < level_; ++b) {
+    if (coefs.bandSize(b) != applied_.bandSize(b)) {
+      return false;
+    }
+  }
+
+  std::vector<DeltaField> band_deltas(level_);
+  for (int b = 0; b < level_; ++b) {
+    for (std::size_t i = coefs.bandBegin(b); i < coefs.bandEnd(b); ++i) {
+      double dx = double(coefs.x()[i]) - double(applied_.x()[i]);
+      double dy = double(coefs.y()[i]) - double(applied_.y()[i]);
+      double dz = double(coefs.z()[i]) - double(applied_.z()[i]);
+      if (dx != 0.0 || dy != 0.0 || dz != 0.0) {
+        band_deltas[b].push(static_cast<std::uint32_t>(i - coefs.bandBegin(b)), dx, dy, dz);
+      }
+    }
+    last_changed_ += band_deltas[b].size();
+  }
+  if (last_changed_ == 0) {
+    return true;
+  }
+
+  if (compiling_ && !compiled_ && !failed_) {
+    failed_ = !compile(mesh);
+  }
+  if (!compiled_) {
+    CoefficientStore::Bands bands;
+    coefs.toBands(bands);
+    if (!coarse_.restore(mesh)) {
+      return false;
+    }
+    synthesize_(mesh, bands, level_);
+    last_moved_ = mesh.size_of_vertices();
+  } else if (last_changed_ * kDenseFraction > coefs.size()) {
+    std::vector<double> p[3];
+    synthesizeDense(coefs, p);
+    parallelFor(0, handles_.size(), kMinChunkVertices, [&](std::size_t begin, std::size_t end) {
+      for (std::size_t i = begin; i < end; ++i) {
+        handles_[i]->point() = Point(p[0][i], p[1][i], p[2][i]);
+      }
+    }, "IncrementalSynthesis::apply");
+    last_moved_ = handles_.size();
+  } else {
+    DeltaField moved;
+    propagate(band_deltas, moved);
+    for (std::size_t i = 0; i < moved.size(); ++i) {
+      Mesh::Vertex_handle v = handles_[moved.index[i]];
+      const Point& p = v->point();
+      v->point() = Point(p.x() + moved.x[i], p.y() + moved.y[i], p.z() + moved.z[i]);
+    }
+    last_moved_ = moved.size();
+  }
+
+  for (int b = 0; b < level_; ++b) {
+    for (std::uint32_t k : band_deltas[b].index) {
+      std::size_t i = coefs.bandBegin(b) + k;
+      applied_.x()[i] = coefs.x()[i];
+      applied_.y()[i] = coefs.y()[i];
+      applied_.z()[i] = coefs.z()[i];
+    }
+  }
+  return true;
+}
+
+std::size_t IncrementalSynthesis::memoryBytes() const {
+  std::size_t bytes = coarse_.memoryBytes() + applied_.memoryBytes() + sizeof(Mesh::Vertex_handle) * handles_.capacity();
+  if (operators_) {
+    for (const LevelOperator& op : *operators_) {
+      bytes += op.memoryBytes();
+    }
+  }
+  return bytes;
+}
+
+bool IncrementalSynthesis::compile(Mesh& mesh) {
+  if (!operators_) {
+    auto operators = std::make_shared<std::vector<LevelOperator>>(level_);
+    Mesh current;
+    if (!coarse_.restore(current)) {
+      return false;
+    }
+    for (int l = 0; l < level_; ++l) {
+      Mesh fine;
+      bool ok = false;
+      for (int radius = LevelOperator::kMinRadius; radius <= LevelOperator::kMaxRadius && !ok; ++radius) {
+        ok = (*operators)[l].compileSynthesis(current, applied_.bandSize(l), synthesize_, radius, fine);
+      }
+      if (!ok) {
+        return false;
+      }
+      current = fine;
+    }
+    operators_ = operators;
+  }
+  for (int l = 0; l < level_; ++l) {
+    if ((*operators_)[l].bandSize() != applied_.bandSize(l)) {
+      operators_.reset();
+      return false;
+    }
+  }
+  if (!verticesById(mesh, handles_) || !verify(mesh)) {
+    operators_.reset();
+    handles_.clear();
+    return false;
+  }
+  compiled_ = true;
+  return true;
+}
+
+// Runs the recorded synthesis through the operators and compares the result
+// with the mesh wtlib produced.
+bool IncrementalSynthesis::verify(const Mesh& mesh) {
+  std::vector<double> p[3];
+  synthesizeDense(applied_, p);
+  if (p[0].size() != mesh.size_of_vertices()) {
+    return false;
+  }
+
+  std::vector<double> q[3];
+  readPositions(mesh, q[0], q[1], q[2]);
+  double scale = 1.0;
+  for (int ch = 0; ch < 3; ++ch) {
+    for (double v : q[ch]) {
+      scale = std::max(scale, std::abs(v));
+    }
+  }
+  for (int ch = 0; ch < 3; ++ch) {
+    for (std::size_t i = 0; i < q[ch].size(); ++i) {
+      if (!(std::abs(p[ch][i] - q[ch][i]) <= kVerifyTolerance * scale)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Fine positions by id for `coefs`, every level applied in full. The
+// snapshot holds the coarse positions by id already.
+void IncrementalSynthesis::synthesizeDense(const CoefficientStore& coefs, std::vector<double> (&p)[3]) const {
+  const std::vector<double>& coarse = coarse_.data().positions;
+  for (int ch = 0; ch < 3; ++ch) {
+    p[ch].resize(coarse.size() / 3);
+    for (std::size_t i = 0; i < p[ch].size(); ++i) {
+      p[ch][i] = coarse[3 * i + ch];
+    }
+  }
+  const CoefficientStore::Scalar* lanes[3] = {coefs.x(), coefs.y(), coefs.z()};
+  std::vector<double> out[3];
+  for (int l = 0; l < level_; ++l) {
+    const LevelOperator& op = (*operators_)[l];
+    for (int ch = 0; ch < 3; ++ch) {
+      const CoefficientStore::Scalar* band = lanes[ch] + coefs.bandBegin(l);
+      p[ch].resize(op.size());
+      for (std::size_t k = 0; k < op.bandSize(); ++k) {
+        p[ch][op.coarseSize() + k] = double(band[k]);
+      }
+      out[ch].resize(op.size());
+    }
+    const double* in[3] = {p[0].data(), p[1].data(), p[2].data()};
+    double* res[3] = {out[0].data(), out[1].data(), out[2].data()};
+    op.apply(in, res);
+    for (int ch = 0; ch < 3; ++ch) {
+      p[ch].swap(out[ch]);
+    }
+  }
+}
+
+void IncrementalSynthesis::propagate(const std::vector<DeltaField>& band_deltas, DeltaField& result) {
+  DeltaField current;
+  DeltaField next;
+  std::vector<std::uint32_t> rows;
+  for (int l = 0; l < level_; ++l) {
+    const LevelOperator& op = (*operators_)[l];
+    if (acc_x_.size() < op.size()) {
+      acc_x_.resize(op.size(), 0.0);
+      acc_y_.resize(op.size(), 0.0);
+      acc_z_.resize(op.size(), 0.0);
+      touched_.resize(op.size(), 0);
+    }
+    // Coarse vertices are the first columns, band coefficients follow.
+    const SparseColumns& m = op.columns();
+    auto scatter = [&](const DeltaField& d, std::size_t column_offset) {
+      for (std::size_t i = 0; i < d.size(); ++i) {
+        std::size_t c = column_offset + d.index[i];
+        for (std::size_t k = m.starts[c]; k < m.starts[c + 1]; ++k) {
+          std::uint32_t row = m.rows[k];
+          double w = m.weights[k];
+          if (!touched_[row]) {
+            touched_[row] = 1;
+            rows.push_back(row);
+          }
+          acc_x_[row] += w * d.x[i];
+          acc_y_[row] += w * d.y[i];
+          acc_z_[row] += w * d.z[i];
+        }
+      }
+    };
+    rows.clear();
+    scatter(current, 0);
+    scatter(band_deltas[l], op.coarseSize());
+
+    next.clear();
+    for (std::uint32_t row : rows) {
+      next.push(row, acc_x_[row], acc_y_[row], acc_z_[row]);
+      acc_x_[row] = 0.0;
+      acc_y_[row] = 0.0;
+      acc_z_[row] = 0.0;
+      touched_[row] = 0;
+    }
+    std::swap(current, next);
+  }
+  result = std::move(current);
+}
@@ -0,0 +1,441 @@
+#include "level_operator.hpp"
+#include "parallel_for.hpp"
+
+#include <wtlib/loop_wavelet_transform.hpp>
+#include <wtlib/butterfly_wavelet_transform.hpp>
+
+#include <algorithm>
+
+namespace {
+
+constexpr std::size_t kMinChunkRows = 1 << 12;
+
+using Point = typename Mesh::Traits::Point_3;
+using Vector3 = typename Mesh::Traits::Vector_3;
+
+template <class MeshT, class Handle>
+bool collectById(MeshT& mesh, std::vector<Handle>& handles) {
+  std::size_t n = mesh.size_of_vertices();
+  handles.assign(n, Handle());
+  for (Handle v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+    if (v->id < 0 || std::size_t(v->id) >= n || handles[v->id] != Handle()) {
+      handles.clear();
+      return false;
+    }
+    handles[v->id] = v;
+  }
+  return true;
+}
+
+bool isZero(const Point& p) {
+  return p.x() == 0.0 && p.y() == 0.0 && p.z() == 0.0;
+}
+
+// Vertex adjacency by id, in compressed rows.
+void buildAdjacency(const Mesh& mesh, std::vector<std::size_t>& starts, std::vector<std::uint32_t>& neighbors) {
+  std::size_t n = mesh.size_of_vertices();
+  starts.assign(n + 1, 0);
+  for (auto v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+    if (v->halfedge() == Mesh::Halfedge_const_handle()) {
+      continue;
+    }
+    auto hc = v->vertex_begin();
+    do {
+      ++starts[v->id + 1];
+    } while (++hc != v->vertex_begin());
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    starts[i + 1] += starts[i];
+  }
+  neighbors.resize(starts[n]);
+  for (auto v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+    if (v->halfedge() == Mesh::Halfedge_const_handle()) {
+      continue;
+    }
+    std::size_t k = starts[v->id];
+    auto hc = v->vertex_begin();
+    do {
+      neighbors[k++] = hc->opposite()->vertex()->id;
+    } while (++hc != v->vertex_begin());
+  }
+}
+
+// Breadth-first search that collects every vertex within `radius` edges of
+// `source`. Visited marks are stamps, so no clearing is needed between calls.
+class BallSearch {
+public:
+  BallSearch(const std::vector<std::size_t>& starts, const std::vector<std::uint32_t>& neighbors):
+  starts_(starts),
+  neighbors_(neighbors),
+  stamps_(starts.size() - 1, 0)
+  {}
+
+  const std::vector<std::uint32_t>& operator()(std::uint32_t source, int radius) {
+    ++stamp_;
+    ball_.clear();
+    ball_.push_back(source);
+    stamps_[source] = stamp_;
+    std::size_t ring_begin = 0;
+    for (int r = 0; r < radius; ++r) {
+      std::size_t ring_end = ball_.size();
+      for (std::size_t i = ring_begin; i < ring_end; ++i) {
+        std::uint32_t v = ball_[i];
+        for (std::size_t k = starts_[v]; k < starts_[v + 1]; ++k) {
+          std::uint32_t w = neighbors_[k];
+          if (stamps_[w] != stamp_) {
+            stamps_[w] = stamp_;
+            ball_.push_back(w);
+          }
+        }
+      }
+      ring_begin = ring_end;
+    }
+    return ball_;
+  }
+
+private:
+  const std::vector<std::size_t>& starts_;
+  const std::vector<std::uint32_t>& neighbors_;
+  std::vector<std::uint32_t> stamps_;
+  std::uint32_t stamp_ = 0;
+  std::vector<std::uint32_t> ball_;
+};
+
+}  // namespace
+
+Synthesize synthesizer(int type) {
+  return [type](Mesh& mesh, const CoefficientStore::Bands& bands, int level) {
+    MeshOps meshops;
+    if (type == 1) {
+      wtlib::butterfly_synthesize(mesh, meshops, bands, level);
+    } else {
+      wtlib::loop_synthesize(mesh, meshops, bands, level);
+    }
+  };
+}
+
+Analyze analyzer(int type) {
+  return [type](Mesh& mesh, CoefficientStore::Bands& bands, int level) {
+    MeshOps meshops;
+    if (type == 1) {
+      return wtlib::butterfly_analyze(mesh, meshops, bands, level);
+    }
+    return wtlib::loop_analyze(mesh, meshops, bands, level);
+  };
+}
+
+bool verticesById(Mesh& mesh, std::vector<Mesh::Vertex_handle>& handles) {
+  return collectById(mesh, handles);
+}
+
+bool verticesById(const Mesh& mesh, std::vector<Mesh::Vertex_const_handle>& handles) {
+  return collectById(mesh, handles);
+}
+
+void readPositions(const Mesh& mesh, std::vector<double>& x, std::vector<double>& y, std::vector<double>& z) {
+  std::size_t n = mesh.size_of_vertices();
+  x.assign(n, 0.0);
+  y.assign(n, 0.0);
+  z.assign(n, 0.0);
+  for (auto v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+    x[v->id] = v->point().x();
+    y[v->id] = v->point().y();
+    z[v->id] = v->point().z();
+  }
+}
+
+bool LevelOperator::compileSynthesis(const Mesh& coarse,
+                                     std::size_t band_size,
+                                     const Synthesize& synthesize,
+                                     int radius,
+                                     Mesh& fine,
+                                     const JobControl* job) {
+  clear();
+  direction_ = SYNTHESIS;
+  std::vector<Mesh::Vertex_const_handle> handles;
+  if (!verticesById(coarse, handles)) {
+    return false;
+  }
+  coarse_size_ = coarse.size_of_vertices();
+
+  // A run without impulses yields the fine connectivity, and must leave every
+  // position at zero for the synthesis to be linear.
+  Mesh zero(coarse);
+  for (auto v = zero.vertices_begin(); v != zero.vertices_end(); ++v) {
+    v->point() = Point(0.0, 0.0, 0.0);
+  }
+  CoefficientStore::Bands bands(1, std::vector<Vector3>(band_size, Vector3(0.0, 0.0, 0.0)));
+  fine = zero;
+  synthesize(fine, bands, 1);
+  std::size_t fine_size = fine.size_of_vertices();
+  if (fine_size != coarse_size_ + band_size || !verticesById(fine, handles)) {
+    return false;
+  }
+  for (Mesh::Vertex_const_handle v : handles) {
+    if (!isZero(v->point())) {
+      return false;
+    }
+  }
+
+  std::size_t coarse_size = coarse_size_;
+  return capture(fine, radius, [&](const double* const in[3], double* const out[3]) {
+    Mesh probe(zero);
+    for (auto v = probe.vertices_begin(); v != probe.vertices_end(); ++v) {
+      v->point() = Point(in[0][v->id], in[1][v->id], in[2][v->id]);
+    }
+    for (std::size_t k = 0; k < band_size; ++k) {
+      std::size_t a = coarse_size + k;
+      bands[0][k] = Vector3(in[0][a], in[1][a], in[2][a]);
+    }
+    synthesize(probe, bands, 1);
+    std::vector<Mesh::Vertex_const_handle> probe_handles;
+    if (probe.size_of_vertices() != fine_size || !verticesById(probe, probe_handles)) {
+      return false;
+    }
+    for (std::size_t i = 0; i < fine_size; ++i) {
+      const Point& p = probe_handles[i]->point();
+      out[0][i] = p.x();
+      out[1][i] = p.y();
+      out[2][i] = p.z();
+    }
+    return true;
+  }, job);
+}
+
+bool LevelOperator::compileAnalysis(const Mesh& fine,
+                                    const Analyze& analyze,
+                                    int radius,
+                                    Mesh& coarse,
+                                    const JobControl* job) {
+  clear();
+  direction_ = ANALYSIS;
+  std::vector<Mesh::Vertex_const_handle> handles;
+  if (!verticesById(fine, handles)) {
+    return false;
+  }
+  std::size_t fine_size = fine.size_of_vertices();
+
+  Mesh zero(fine);
+  for (auto v = zero.vertices_begin(); v != zero.vertices_end(); ++v) {
+    v->point() = Point(0.0, 0.0, 0.0);
+  }
+  CoefficientStore::Bands bands;
+  coarse = zero;
+  if (!analyze(coarse, bands, 1) || bands.size() != 1 || !verticesById(coarse, handles)) {
+    return false;
+  }
+  coarse_size_ = coarse.size_of_vertices();
+  std::size_t band_size = bands[0].size();
+  if (coarse_size_ + band_size != fine_size) {
+    return false;
+  }
+  for (Mesh::Vertex_const_handle v : handles) {
+    if (!isZero(v->point())) {
+      return false;
+    }
+  }
+  for (const Vector3& c : bands[0]) {
+    if (c.x() != 0.0 || c.y() != 0.0 || c.z() != 0.0) {
+      return false;
+    }
+  }
+
+  std::size_t coarse_size = coarse_size_;
+  return capture(fine, radius, [&](const double* const in[3], double* const out[3]) {
+    Mesh probe(zero);
+    for (auto v = probe.vertices_begin(); v != probe.vertices_end(); ++v) {
+      v->point() = Point(in[0][v->id], in[1][v->id], in[2][v->id]);
+    }
+    CoefficientStore::Bands probe_bands;
+    std::vector<Mesh::Vertex_const_handle> probe_handles;
+    if (!analyze(probe, probe_bands, 1) ||
+        probe_bands.size() != 1 || probe_bands[0].size() != band_size ||
+        probe.size_of_vertices() != coarse_size || !verticesById(probe, probe_handles)) {
+      return false;
+    }
+    for (std::size_t i = 0; i < coarse_size; ++i) {
+      const Point& p = probe_handles[i]->point();
+      out[0][i] = p.x();
+      out[1][i] = p.y();
+      out[2][i] = p.z();
+    }
+    for (std::size_t k = 0; k < band_size; ++k) {
+      const Vector3& c = probe_bands[0][k];
+      out[0][coarse_size + k] = c.x();
+      out[1][coarse_size + k] = c.y();
+      out[2][coarse_size + k] = c.z();
+    }
+    return true;
+  }, job);
+}
+
+// Colors the inputs so that any two of one color are more than 2 * radius
+// edges apart in `fine`, probes three colors per run and keeps every nonzero
+// output within `radius` of its impulse. Outputs found anywhere else mean the
+// radius was too small.
+bool LevelOperator::capture(const Mesh& fine, int radius, const Probe& probe, const JobControl* job) {
+  std::size_t n = fine.size_of_vertices();
+  std::vector<std::size_t> adj_starts;
+  std::vector<std::uint32_t> adj;
+  buildAdjacency(fine, adj_starts, adj);
+  BallSearch ball(adj_starts, adj);
+
+  std::vector<int> colors(n, -1);
+  std::vector<std::size_t> color_marks;
+  for (std::uint32_t a = 0; a < n; ++a) {
+    for (std::uint32_t v : ball(a, 2 * radius)) {
+      if (colors[v] >= 0) {
+        color_marks[colors[v]] = a + 1;
+      }
+    }
+    std::size_t c = 0;
+    while (c < color_marks.size() && color_marks[c] == a + 1) {
+      ++c;
+    }
+    if (c == color_marks.size()) {
+      color_marks.push_back(0);
+    }
+    colors[a] = static_cast<int>(c);
+  }
+  std::size_t color_count = color_marks.size();
+  color_starts_.assign(color_count + 1, 0);
+  for (int c : colors) {
+    ++color_starts_[c + 1];
+  }
+  for (std::size_t c = 0; c < color_count; ++c) {
+    color_starts_[c + 1] += color_starts_[c];
+  }
+  color_columns_.resize(n);
+  {
+    std::vector<std::size_t> next(color_starts_.begin(), color_starts_.end() - 1);
+    for (std::uint32_t a = 0; a < n; ++a) {
+      color_columns_[next[colors[a]]++] = a;
+    }
+  }
+
+  std::vector<double> in_lanes[3];
+  std::vector<double> out_lanes[3];
+  for (int ch = 0; ch < 3; ++ch) {
+    in_lanes[ch].resize(n);
+    out_lanes[ch].resize(n);
+  }
+  const double* in[3] = {in_lanes[0].data(), in_lanes[1].data(), in_lanes[2].data()};
+  double* out[3] = {out_lanes[0].data(), out_lanes[1].data(), out_lanes[2].data()};
+
+  std::vector<std::uint32_t> t_cols;
+  std::vector<std::uint32_t> t_rows;
+  std::vector<double> t_weights;
+  runs_ = (color_count + 2) / 3;
+  for (std::size_t r = 0; r < runs_; ++r) {
+    int c0 = static_cast<int>(3 * r);
+    for (int ch = 0; ch < 3; ++ch) {
+      for (std::size_t a = 0; a < n; ++a) {
+        in_lanes[ch][a] = colors[a] == c0 + ch ? 1.0 : 0.0;
+      }
+    }
+    if ((job && job->cancelled()) || !probe(in, out)) {
+      clear();
+      return false;
+    }
+    for (int ch = 0; ch < 3 && std::size_t(c0 + ch) < color_count; ++ch) {
+      const std::vector<double>& o = out_lanes[ch];
+      std::size_t nonzeros = n - std::count(o.begin(), o.end(), 0.0);
+      std::size_t found = 0;
+      for (std::size_t i = color_starts_[c0 + ch]; i < color_starts_[c0 + ch + 1]; ++i) {
+        std::uint32_t a = color_columns_[i];
+        for (std::uint32_t v : ball(a, radius)) {
+          if (o[v] != 0.0) {
+            t_cols.push_back(a);
+            t_rows.push_back(v);
+            t_weights.push_back(o[v]);
+            ++found;
+          }
+        }
+      }
+      if (found != nonzeros) {
+        clear();
+        return false;
+      }
+    }
+  }
+
+  // Triplets to columns, keeping the order of every column's rows.
+  columns_.starts.assign(n + 1, 0);
+  for (std::uint32_t c : t_cols) {
+    ++columns_.starts[c + 1];
+  }
+  for (std::size_t c = 0; c < n; ++c) {
+    columns_.starts[c + 1] += columns_.starts[c];
+  }
+  columns_.rows.resize(t_cols.size());
+  columns_.weights.resize(t_cols.size());
+  std::vector<std::size_t> next(columns_.starts.begin(), columns_.starts.end() - 1);
+  for (std::size_t t = 0; t < t_cols.size(); ++t) {
+    std::size_t k = next[t_cols[t]]++;
+    columns_.rows[k] = t_rows[t];
+    columns_.weights[k] = t_weights[t];
+  }
+  buildRows();
+  return true;
+}
+
+// Transposes the columns color by color, so every row lists its entries in
+// the order the colors are applied.
+void LevelOperator::buildRows() {
+  std::size_t n = size();
+  rows_.starts.assign(n + 1, 0);
+  for (std::uint32_t r : columns_.rows) {
+    ++rows_.starts[r + 1];
+  }
+  for (std::size_t r = 0; r < n; ++r) {
+    rows_.starts[r + 1] += rows_.starts[r];
+  }
+  rows_.columns.resize(columns_.nonZeros());
+  rows_.weights.resize(columns_.nonZeros());
+  std::vector<std::size_t> next(rows_.starts.begin(), rows_.starts.end() - 1);
+  for (std::uint32_t col : color_columns_) {
+    for (std::size_t k = columns_.starts[col]; k < columns_.starts[col + 1]; ++k) {
+      std::size_t e = next[columns_.rows[k]]++;
+      rows_.columns[e] = col;
+      rows_.weights[e] = columns_.weights[k];
+    }
+  }
+}
+
+void LevelOperator::clear() {
+  coarse_size_ = 0;
+  columns_.clear();
+  rows_.clear();
+  color_starts_.assign(1, 0);
+  color_columns_.clear();
+  runs_ = 0;
+}
+
+std::size_t LevelOperator::memoryBytes() const {
+  return sizeof(std::size_t) * (columns_.starts.size() + rows_.starts.size() + color_starts_.size()) +
+         2 * (sizeof(std::uint32_t) + sizeof(double)) * columns_.rows.size() +
+         sizeof(std::uint32_t) * color_columns_.size();
+}
+
+void LevelOperator::apply(const double* const in[3], double* const out[3]) const {
+  const std::size_t* starts = rows_.starts.data();
+  const std::uint32_t* columns = rows_.columns.data();
+  const double* weights = rows_.weights.data();
+  parallelFor(0, size(), kMinChunkRows, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t r = begin; r < end; ++r) {
+      double x = 0.0;
+      double y = 0.0;
+      double z = 0.0;
+      for (std::size_t k = starts[r]; k < starts[r + 1]; ++k) {
+        double w = weights[k];
+        std::uint32_t c = columns[k];
+        x += w * in[0][c];
+        y += w * in[1][c];
+        z += w * in[2][c];
+      }
+      out[0][r] = x;
+      out[1][r] = y;
+      out[2][r] = z;
+    }
+  }, "LevelOperator::apply");
+}
@@ -3,6 +3,7 @@
 #include "opengl_widget.hpp"
 #include "integer_setter.hpp"
 #include "input_prop.hpp"
+#include "equalizer_panel.hpp"
 #include "mainwindow.hpp"
 #include "wtt_manager.hpp"
 
@@ -11,8 +12,11 @@
 #include <QScreen>
 #include <QMovie>
 #include <QLabel>
+#include <QPushButton>
 #include <QFileDialog>
 #include <QGraphicsOpacityEffect>
+#include <QShortcut>
+#include <QKeySequence>
 
 #include <QOffscreenSurface>
 
@@ -32,17 +36,20 @@ MainWindow::MainWindow(QWidget* parent):QMainWindow(parent),
                                         iwt_level_setter_ptr_(new IntegerSetter(this)),
                                         denoise_level_setter_ptr_(new IntegerSetter(this)),
                                         compress_rate_setter_ptr_(new InputProp(this)),
+                                        equalizer_panel_ptr_(new EqualizerPanel(this)),
                                         wtt_manager_(new WTTManager()),
                                         debug(DebugLogger("[MainWindow]")),
                                         critical(FatalLogger("[MainWindow]"))
 {
   qRegisterMetaType<BoundingBox>();
+  qRegisterMetaType<QVector<double>>();
   ui_ptr_->setupUi(this);
   ui_ptr_->main_layout->addWidget(opengl_widget_ptr_);
   
   info_label_ui_->setupUi(info_label_);
 
   info_label_->hide();
+  equalizer_panel_ptr_->hide();
   action_panel_ptr_->raise();
   action_panel_ptr_->show();
 
@@ -85,6 +92,9 @@ void MainWindow::initWidgets() {
   QGraphicsOpacityEffect* e = new QGraphicsOpacityEffect(proc_diag_ptr_);
   e->setOpacity(0.85);
   proc_diag_ptr_->setGraphicsEffect(e);
+  proc_status_ptr_ = proc_diag_ptr_->addLabel("status");
+  proc_cancel_ptr_ = proc_diag_ptr_->addButton("Cancel", "cancel_button");
+  connect(proc_cancel_ptr_, &QPushButton::clicked, this, &MainWindow::onCancelJob);
 
 
   msg_prop_ptr_->addAcceptButton("Confirm");
@@ -124,6 +134,7 @@ void MainWindow::initializeGeometry()
                     1024 * scale,
                     768 * scale);
 
+  proc_diag_ptr_->resetButtonSize(QSize(128, 32) * scale);
   msg_prop_ptr_->resetButtonSize(QSize(128, 32) * scale);
   wt_type_setter_ptr_->resetButtonSize(QSize(128, 32) * scale);
   fwt_level_setter_ptr_->resetButtonSize(QSize(128, 32) * scale);
@@ -159,9 +170,19 @@ void MainWindow::resizeEvent(QResizeEvent* e)
   iwt_level_setter_ptr_->setGeometry(0, 0, this->width(), this->height());
   denoise_level_setter_ptr_->setGeometry(0, 0, this->width(), this->height());
   compress_rate_setter_ptr_->setGeometry(0, 0, this->width(), this->height());
+  placeEqualizerPanel();
   QMainWindow::resizeEvent(e); 
 }
 
+void MainWindow::placeEqualizerPanel() {
+  qreal scale = qApp->primaryScreen()->logicalDotsPerInch() / 96.0;
+  QSize equalizer_size = equalizer_panel_ptr_->sizeHint();
+  equalizer_panel_ptr_->setGeometry(this->width() - equalizer_size.width() - 20 * scale,
+                                    0.5 * (this->height() - equalizer_size.height()),
+                                    equalizer_size.width(),
+                                    equalizer_size.height());
+}
+
 void MainWindow::setupConnections() {
   debug() << "setup connections";
   connect(action_panel_ptr_, &ActionPanel::userAction, this, &MainWindow::onUserAction);
@@ -172,28 +193,66 @@ void MainWindow::setupConnections() {
   connect(denoise_level_setter_ptr_, &IntegerSetter::finished, this, &MainWindow::onDenoiseLevelSet);
   connect(compress_rate_setter_ptr_, &InputProp::finished, this, &MainWindow::onCompressRateSet);
 
-  connect(this, &MainWindow::loadMesh, wtt_manager_, &WTTManager::onLoadMesh);
+  // Requests go through the command queue of the manager, which runs them
+  // on its thread and coalesces bursts.
+  WTTManager* m = wtt_manager_;
+  connect(this, &MainWindow::loadMesh, [m](QString filename) {
+    m->post(WTTManager::LOAD, [m, filename] { m->onLoadMesh(filename); });
+  });
   connect(wtt_manager_, &WTTManager::meshLoaded, this, &MainWindow::onMeshLoaded);
-  connect(this, &MainWindow::resetMesh, wtt_manager_, &WTTManager::onResetMesh);
+  connect(this, &MainWindow::resetMesh, [m]() {
+    m->post(WTTManager::RESET, [m] { m->onResetMesh(); });
+  });
   connect(wtt_manager_, &WTTManager::meshReset, this, &MainWindow::onMeshReset);
-  connect(this, &MainWindow::doFWT, wtt_manager_, &WTTManager::onDoFWT);
-  connect(this, &MainWindow::doIWT, wtt_manager_, &WTTManager::onDoIWT);
+  connect(this, &MainWindow::doFWT, [m](int type, int level) {
+    m->post(WTTManager::FWT, [m, type, level] { m->onDoFWT(type, level); });
+  });
+  connect(this, &MainWindow::doIWT, [m](int type, int level) {
+    m->post(WTTManager::IWT, [m, type, level] { m->onDoIWT(type, level); });
+  });
   connect(wtt_manager_, &WTTManager::fwtDone, this, &MainWindow::onFWTDone);
   connect(wtt_manager_, &WTTManager::iwtDone, this, &MainWindow::onIWTDone);
   connect(wtt_manager_, &WTTManager::compressDone, this, &MainWindow::onCompressDone);
   connect(wtt_manager_, &WTTManager::denoiseDone, this, &MainWindow::onDenoiseDone);
-  connect(this, &MainWindow::doCompress, wtt_manager_, &WTTManager::onCompress);
-  connect(this, &MainWindow::doDenoise, wtt_manager_, &WTTManager::onDenoise);
+  connect(this, &MainWindow::doCompress, [m](double perc) {
+    m->post(WTTManager::COMPRESS, [m, perc] { m->onCompress(perc); });
+  });
+  connect(this, &MainWindow::doDenoise, [m](int level) {
+    m->post(WTTManager::DENOISE, [m, level] { m->onDenoise(level); });
+  });
   connect(wtt_manager_, &WTTManager::updateMeshInfo, this, &MainWindow::onUpdateMeshInfo);
+  connect(wtt_manager_, &WTTManager::progress, this, &MainWindow::onJobProgress);
+  connect(wtt_manager_, &WTTManager::cancellable, this, &MainWindow::onJobCancellable);
+  connect(wtt_manager_, &WTTManager::jobCancelled, this, &MainWindow::onJobCancelled);
+  connect(equalizer_panel_ptr_, &EqualizerPanel::gainsChanged, this, &MainWindow::setBandGains);
+  connect(this, &MainWindow::setBandGains, [m](QVector<double> gains) {
+    m->post(WTTManager::GAINS, [m, gains] { m->onSetBandGains(gains); });
+  });
+  connect(equalizer_panel_ptr_, &EqualizerPanel::gainsCommitted, [m]() {
+    m->post(WTTManager::GAINS_DONE, [m] { m->onGainsDone(); });
+  });
+
+  connect(new QShortcut(QKeySequence::Undo, this), &QShortcut::activated, this, &MainWindow::undo);
+  connect(new QShortcut(QKeySequence::Redo, this), &QShortcut::activated, this, &MainWindow::redo);
+  connect(this, &MainWindow::undo, [m]() {
+    m->post(WTTManager::UNDO, [m] { m->onUndo(); });
+  });
+  connect(this, &MainWindow::redo, [m]() {
+    m->post(WTTManager::REDO, [m] { m->onRedo(); });
+  });
+  connect(wtt_manager_, &WTTManager::historyStepped, this, &MainWindow::onHistoryStepped);
 
   connect(opengl_widget_ptr_, &OpenGLWidget::openglReady, this, &MainWindow::onOpenGLReady);
-  connect(wtt_manager_, &WTTManager::bufferUploaded, opengl_widget_ptr_, &OpenGLWidget::onBufferUpdated);
+  connect(wtt_manager_->uploader(), &RenderUploader::bufferUploaded, opengl_widget_ptr_, &OpenGLWidget::onBufferUpdated);
 }
 
 void MainWindow::onOpenGLReady() {
   debug() << "Receive signal: OpenGL ready";
-  opengl_widget_ptr_->shareContextWith(wtt_manager_);
+  RenderUploader* uploader = wtt_manager_->uploader();
+  opengl_widget_ptr_->shareContextWith(uploader);
   wtt_manager_->obtainSceneInOtherThread(opengl_widget_ptr_->getScene());
+  uploader->moveToThread(uploader);
+  uploader->start();
   wtt_manager_->moveToThread(wtt_manager_);
   wtt_manager_->start();
 }
@@ -203,9 +262,9 @@ void MainWindow::onUserAction(int action)
   QString fileName;
   switch (action) {
     case ActionPanel::OPENMESH:
-      proc_diag_ptr_->open();
+      openProcessing();
       debug() << "User action: open mesh";
-      fileName = QFileDialog::getOpenFileName(this, "Open Mesh", MESH_DATA_DIR, "OFF Files (*.off)");
+      fileName = QFileDialog::getOpenFileName(this, "Open Mesh", MESH_DATA_DIR, "Mesh Files (*.off *.wttm)");
       debug() << "User open file: " << fileName;
       if (fileName.isEmpty()) {
         proc_diag_ptr_->done();
@@ -214,7 +273,7 @@ void MainWindow::onUserAction(int action)
       }
       break;
     case ActionPanel::RESETMESH:
-      proc_diag_ptr_->open();
+      openProcessing();
       debug() << "User action: reset";
       emit resetMesh();
       break;
@@ -244,6 +303,46 @@ void MainWindow::onUserAction(int action)
   }
 }
 
+void MainWindow::openProcessing() {
+  proc_status_ptr_->clear();
+  onJobCancellable(true);
+  proc_diag_ptr_->open();
+}
+
+// The dialog stays up until the job has stopped.
+void MainWindow::onCancelJob() {
+  debug() << "User action: cancel";
+  wtt_manager_->cancelJob();
+  proc_status_ptr_->setText("Cancelling");
+}
+
+void MainWindow::onJobProgress(QString text) {
+  proc_status_ptr_->setText(text);
+}
+
+// Queued behind the progress of the step it precedes, so the button follows
+// what the status line shows.
+void MainWindow::onJobCancellable(bool cancellable) {
+  proc_cancel_ptr_->setEnabled(cancellable);
+  proc_cancel_ptr_->setToolTip(cancellable ? QString() : "This step cannot be cancelled");
+}
+
+void MainWindow::onJobCancelled() {
+  debug() << "Receive signal: job cancelled";
+  proc_diag_ptr_->done(1);
+}
+
+void MainWindow::onHistoryStepped(int levels, QVector<double> gains) {
+  debug() << "Receive signal: history stepped to" << levels << "levels";
+  action_panel_ptr_->onIWTDone(levels > 0);
+  denoise_level_setter_ptr_->setMax(levels);
+  equalizer_panel_ptr_->setBandCount(levels);
+  equalizer_panel_ptr_->setGains(gains);
+  equalizer_panel_ptr_->setVisible(levels > 0);
+  equalizer_panel_ptr_->raise();
+  placeEqualizerPanel();
+}
+
 void MainWindow::onOpenGLLoadMesh() {
   debug() << "Receive signal: Mesh rendered by OpenGL";
 }
@@ -270,6 +369,7 @@ void MainWindow::onMeshLoaded(BoundingBox b, QString err) {
     msg_prop_ptr_->exec();
   }
   proc_diag_ptr_->done(1);
+  equalizer_panel_ptr_->hide();
   denoise_level_setter_ptr_->setValue(0);
   denoise_level_setter_ptr_->setMax(0);
   fwt_level_setter_ptr_->setValue(0);
@@ -277,6 +377,7 @@ void MainWindow::onMeshLoaded(BoundingBox b, QString err) {
 }
 
 void MainWindow::onMeshReset() {
+  equalizer_panel_ptr_->hide();
   proc_diag_ptr_->done(0);
 }
 
@@ -284,7 +385,7 @@ void MainWindow::onFWTLevelSet(int code) {
   if (code == IntegerSetter::Accepted) {
     int level = fwt_level_setter_ptr_->getValue();
     debug() << "Receive request: " << level << " levels FWT transform";
-    proc_diag_ptr_->open();
+    openProcessing();
     emit doFWT(wt_type_, level);
   } 
 }
@@ -293,7 +394,7 @@ void MainWindow::onIWTLevelSet(int code) {
   if (code == IntegerSetter::Accepted) {
     int level = iwt_level_setter_ptr_->getValue();
     debug() << "Receive request: " << level << " levels IWT transform";
-    proc_diag_ptr_->open();
+    openProcessing();
     emit doIWT(wt_type_, level);
   } 
 }
@@ -302,7 +403,7 @@ void MainWindow::onCompressRateSet(int code) {
   if (code == InputProp::Accepted) {
     double perc = compress_rate_setter_ptr_->getValue();
     debug() << "Send signal: compression" << perc << "%";
-    proc_diag_ptr_->open();
+    openProcessing();
     emit doCompress(perc);
   } 
 }
@@ -311,7 +412,7 @@ void MainWindow::onDenoiseLevelSet(int code) {
   if (code == IntegerSetter::Accepted) {
     int level = denoise_level_setter_ptr_->getValue();
     debug() << "Send signal: denoising (level =" << level <<")";
-    proc_diag_ptr_->open();
+    openProcessing();
     emit doDenoise(level);
   }
 }
@@ -320,6 +421,7 @@ void MainWindow::onDenoiseLevelSet(int code) {
 void MainWindow::onWTTypeSet(int type) {
   debug() << "Receive signal: WT type set to" << type;
   action_panel_ptr_->onTypeSelected(type);
+  equalizer_panel_ptr_->hide();
   wt_type_ = type;
 }
 
@@ -331,6 +433,11 @@ void MainWindow::onFWTDone(bool succ, int level, QString err) {
     denoise_level_setter_ptr_->setMax(level);
     denoise_level_setter_ptr_->setValue(0);
     iwt_level_setter_ptr_->setValue(level);
+    equalizer_panel_ptr_->setBandCount(level);
+    equalizer_panel_ptr_->resetGains();
+    equalizer_panel_ptr_->setVisible(level > 0);
+    equalizer_panel_ptr_->raise();
+    placeEqualizerPanel();
   } else {
     msg_prop_ptr_->getDescription()->setText(err);
     msg_prop_ptr_->exec();
@@ -342,8 +449,8 @@ void MainWindow::onFWTDone(bool succ, int level, QString err) {
 void MainWindow::onIWTDone(bool succ, int level, QString err) {
   debug() << "Receive signal:" << level << "levels IWT done";
   proc_diag_ptr_->done(1);
-  denoise_level_setter_ptr_->setMax(0);
-  denoise_level_setter_ptr_->setValue(0);
+  denoise_level_setter_ptr_->setMax(succ ? level : 0);
+  denoise_level_setter_ptr_->setValue(succ ? level : 0);
   if (succ) {
     action_panel_ptr_->onIWTDone(true);
     if (!err.isEmpty()) {
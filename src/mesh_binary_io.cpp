@@ -0,0 +1,230 @@
+#include "mesh_binary_io.hpp"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+
+const char kMagic[4] = {'W', 'T', 'T', 'M'};
+constexpr qint64 kHeaderSize = 32;
+
+qint64 align8(qint64 offset) {
+  return (offset + 7) & ~qint64(7);
+}
+
+struct Layout {
+  qint64 positions;
+  qint64 triangles;
+  qint64 ids;
+  qint64 types;
+  qint64 levels;
+  qint64 borders;
+  qint64 end;
+};
+
+Layout layout(quint64 vsize, quint64 fsize, bool tags) {
+  Layout l;
+  l.positions = kHeaderSize;
+  l.triangles = align8(l.positions + 24 * qint64(vsize));
+  l.ids = align8(l.triangles + 12 * qint64(fsize));
+  l.types = l.ids + (tags ? 4 * qint64(vsize) : 0);
+  l.levels = l.types + (tags ? 4 * qint64(vsize) : 0);
+  l.borders = l.levels + (tags ? 4 * qint64(vsize) : 0);
+  l.end = l.borders + (tags ? qint64(vsize) : 0);
+  return l;
+}
+
+// Element-wise conversion to and from the on-disk byte order. On little
+// endian hosts these are plain copies.
+template <class T>
+T toDisk(T v) {
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+  using U = typename std::conditional<sizeof(T) == 8, quint64, typename std::conditional<sizeof(T) == 4, quint32, quint8>::type>::type;
+  U u;
+  std::memcpy(&u, &v, sizeof(T));
+  u = qToLittleEndian(u);
+  std::memcpy(&v, &u, sizeof(T));
+#endif
+  return v;
+}
+
+template <class T>
+T fromDisk(T v) {
+  return toDisk(v);
+}
+
+template <class T>
+bool writeArray(QSaveFile& file, const T* data, std::size_t count) {
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+  std::vector<T> swapped(data, data + count);
+  for (T& v : swapped) {
+    v = toDisk(v);
+  }
+  data = swapped.data();
+#endif
+  qint64 bytes = qint64(sizeof(T) * count);
+  return file.write(reinterpret_cast<const char*>(data), bytes) == bytes;
+}
+
+bool writePadding(QSaveFile& file, qint64 offset) {
+  static const char zeros[8] = {0};
+  qint64 pad = align8(offset) - offset;
+  return pad == 0 || file.write(zeros, pad) == pad;
+}
+
+// Returns the array stored at `offset`, either pointing into the mapping or,
+// on big endian hosts, into a converted copy kept in `storage`.
+template <class T>
+const T* viewArray(const uchar* base, qint64 offset, std::size_t count, std::vector<T>& storage) {
+  const T* data = reinterpret_cast<const T*>(base + offset);
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+  storage.assign(data, data + count);
+  for (T& v : storage) {
+    v = fromDisk(v);
+  }
+  return storage.data();
+#else
+  Q_UNUSED(count);
+  Q_UNUSED(storage);
+  return data;
+#endif
+}
+
+}  // namespace
+
+MeshBinaryIO::Status MeshBinaryIO::save(const QString& filename, const Mesh& mesh) {
+  MeshData data;
+  extractMeshData(mesh, data, true);
+  return save(filename, data);
+}
+
+MeshBinaryIO::Status MeshBinaryIO::save(const QString& filename, const MeshData& data) {
+  QElapsedTimer timer;
+  timer.start();
+  err_.clear();
+  QSaveFile file(filename);
+  if (!file.open(QFile::WriteOnly)) {
+    err_ = "Fail to open " + filename;
+    return OPEN_ERROR;
+  }
+
+  quint64 vsize = data.vertexCount();
+  quint64 fsize = data.faceCount();
+  bool tags = data.hasTags();
+  Layout l = layout(vsize, fsize, tags);
+
+  char header[kHeaderSize] = {0};
+  std::memcpy(header, kMagic, 4);
+  qToLittleEndian<quint32>(kVersion, header + 4);
+  qToLittleEndian<quint32>(tags ? HAS_VERTEX_TAGS : 0, header + 8);
+  qToLittleEndian<quint64>(vsize, header + 16);
+  qToLittleEndian<quint64>(fsize, header + 24);
+
+  bool ok = file.write(header, kHeaderSize) == kHeaderSize &&
+            writeArray(file, data.positions.data(), 3 * vsize) &&
+            writePadding(file, l.positions + 24 * qint64(vsize)) &&
+            writeArray(file, data.triangles.data(), 3 * fsize) &&
+            writePadding(file, l.triangles + 12 * qint64(fsize));
+  if (ok && tags) {
+    ok = writeArray(file, data.ids.data(), vsize) &&
+         writeArray(file, data.types.data(), vsize) &&
+         writeArray(file, data.levels.data(), vsize) &&
+         writeArray(file, data.borders.data(), vsize);
+  }
+  if (!ok || !file.commit()) {
+    err_ = "Fail to write " + filename + ": " + file.errorString();
+    return WRITE_ERROR;
+  }
+  nsecs_ = timer.nsecsElapsed();
+  return OK;
+}
+
+MeshBinaryIO::Status MeshBinaryIO::load(const QString& filename, Mesh& mesh) {
+  QElapsedTimer timer;
+  timer.start();
+  err_.clear();
+  mesh.clear();
+  QFile file(filename);
+  if (!file.open(QFile::ReadOnly)) {
+    err_ = "Fail to open " + filename;
+    return OPEN_ERROR;
+  }
+  qint64 size = file.size();
+  if (size < kHeaderSize) {
+    err_ = filename + " is not a WTTM file";
+    return FORMAT_ERROR;
+  }
+  uchar* base = file.map(0, size);
+  if (!base) {
+    err_ = "Fail to map " + filename;
+    return OPEN_ERROR;
+  }
+
+  Status status = OK;
+  quint32 version = qFromLittleEndian<quint32>(base + 4);
+  quint32 flags = qFromLittleEndian<quint32>(base + 8);
+  quint64 vsize = qFromLittleEndian<quint64>(base + 16);
+  quint64 fsize = qFromLittleEndian<quint64>(base + 24);
+  bool tags = flags & HAS_VERTEX_TAGS;
+  // Reject counts that could overflow the layout arithmetic before using it.
+  bool sane = vsize < (quint64(1) << 32) && fsize < (quint64(1) << 40);
+  Layout l = layout(sane ? vsize : 0, sane ? fsize : 0, tags);
+  if (std::memcmp(base, kMagic, 4) != 0) {
+    err_ = filename + " is not a WTTM file";
+    status = FORMAT_ERROR;
+  } else if (version != kVersion) {
+    err_ = "Unsupported WTTM version " + QString::number(version);
+    status = FORMAT_ERROR;
+  } else if (!sane || l.end > size) {
+    err_ = filename + " is truncated";
+    status = FORMAT_ERROR;
+  }
+
+  if (status == OK) {
+    std::vector<double> positions;
+    std::vector<std::uint32_t> triangles;
+    const double* p = viewArray(base, l.positions, 3 * vsize, positions);
+    const std::uint32_t* t = viewArray(base, l.triangles, 3 * fsize, triangles);
+    bool indices_valid = true;
+    for (quint64 i = 0; i < 3 * fsize && indices_valid; ++i) {
+      indices_valid = t[i] < vsize;
+    }
+    // Stored vertex ids must be a permutation of [0, n), everything that
+    // orders vertices by id relies on it.
+    std::vector<std::int32_t> ids;
+    const std::int32_t* id = tags ? viewArray(base, l.ids, vsize, ids) : nullptr;
+    bool ids_valid = true;
+    if (tags) {
+      std::vector<bool> seen(vsize, false);
+      for (quint64 i = 0; i < vsize && ids_valid; ++i) {
+        ids_valid = id[i] >= 0 && quint64(id[i]) < vsize && !seen[id[i]];
+        if (ids_valid) {
+          seen[id[i]] = true;
+        }
+      }
+    }
+    if (!ids_valid) {
+      err_ = filename + " has vertex ids that are not a permutation";
+      status = FORMAT_ERROR;
+    } else if (!indices_valid || !buildMesh(mesh, p, vsize, t, fsize)) {
+      err_ = filename + " does not hold a valid polyhedral surface";
+      mesh.clear();
+      status = BUILD_ERROR;
+    } else if (tags) {
+      std::vector<std::int32_t> types, levels;
+      std::vector<std::uint8_t> borders;
+      applyVertexTags(mesh,
+                      id,
+                      viewArray(base, l.types, vsize, types),
+                      viewArray(base, l.levels, vsize, levels),
+                      viewArray(base, l.borders, vsize, borders));
+    }
+  }
+  file.unmap(base);
+  nsecs_ = timer.nsecsElapsed();
+  return status;
+}
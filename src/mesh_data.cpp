@@ -0,0 +1,197 @@
+#include "mesh_data.hpp"
+
+#include <cstring>
+#include <unordered_map>
+
+bool buildMesh(Mesh& mesh,
+               const double* positions,
+               std::size_t vsize,
+               const std::uint32_t* triangles,
+               std::size_t fsize) {
+  mesh.clear();
+  FlatMeshBuilder<Mesh::HalfedgeDS> builder(positions, vsize, triangles, fsize);
+  mesh.delegate(builder);
+  return builder.succeeded();
+}
+
+bool buildMesh(Mesh& mesh, const MeshData& data) {
+  if (!buildMesh(mesh,
+                 data.positions.data(),
+                 data.vertexCount(),
+                 data.triangles.data(),
+                 data.faceCount())) {
+    return false;
+  }
+  if (data.hasTags()) {
+    applyVertexTags(mesh, data.ids.data(), data.types.data(), data.levels.data(), data.borders.data());
+  }
+  return true;
+}
+
+void applyVertexTags(Mesh& mesh,
+                     const std::int32_t* ids,
+                     const std::int32_t* types,
+                     const std::int32_t* levels,
+                     const std::uint8_t* borders) {
+  std::size_t i = 0;
+  for (Mesh::Vertex_iterator v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v, ++i) {
+    v->id = ids[i];
+    v->type = types[i];
+    v->level = levels[i];
+    v->border = borders[i] != 0;
+  }
+}
+
+void extractMeshData(const Mesh& mesh, MeshData& data, bool with_tags) {
+  using Vertex = Mesh::Vertex_const_handle;
+  std::size_t vsize = mesh.size_of_vertices();
+  std::size_t fsize = mesh.size_of_facets();
+  data.clear();
+
+  bool ids_valid = true;
+  std::vector<char> seen(vsize, 0);
+  for (Vertex v = mesh.vertices_begin(); v != mesh.vertices_end() && ids_valid; ++v) {
+    ids_valid = v->id >= 0 && static_cast<std::size_t>(v->id) < vsize && !seen[v->id];
+    if (ids_valid) {
+      seen[v->id] = 1;
+    }
+  }
+  std::unordered_map<const void*, std::uint32_t> order;
+  if (!ids_valid) {
+    order.reserve(vsize);
+    std::uint32_t i = 0;
+    for (Vertex v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+      order.emplace(&*v, i++);
+    }
+  }
+  auto index = [&](Vertex v) -> std::uint32_t {
+    return ids_valid ? static_cast<std::uint32_t>(v->id) : order.at(&*v);
+  };
+
+  data.positions.resize(3 * vsize);
+  if (with_tags) {
+    data.ids.resize(vsize);
+    data.types.resize(vsize);
+    data.levels.resize(vsize);
+    data.borders.resize(vsize);
+  }
+  for (Vertex v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+    std::uint32_t i = index(v);
+    data.positions[3 * i] = v->point().x();
+    data.positions[3 * i + 1] = v->point().y();
+    data.positions[3 * i + 2] = v->point().z();
+    if (with_tags) {
+      data.ids[i] = v->id;
+      data.types[i] = v->type;
+      data.levels[i] = v->level;
+      data.borders[i] = v->border ? 1 : 0;
+    }
+  }
+
+  data.triangles.reserve(3 * fsize);
+  for (Mesh::Facet_const_iterator f = mesh.facets_begin(); f != mesh.facets_end(); ++f) {
+    Mesh::Halfedge_const_handle h = f->halfedge();
+    data.triangles.push_back(index(h->vertex()));
+    data.triangles.push_back(index(h->next()->vertex()));
+    data.triangles.push_back(index(h->next()->next()->vertex()));
+  }
+}
+
+MeshSnapshot::MeshSnapshot(const Mesh& mesh) {
+  auto data = std::make_shared<MeshData>();
+  extractMeshData(mesh, *data, true);
+  data_ = data;
+}
+
+MeshSnapshot::MeshSnapshot(MeshData&& data):
+data_(std::make_shared<const MeshData>(std::move(data)))
+{}
+
+const MeshData& MeshSnapshot::data() const {
+  static const MeshData kEmpty;
+  return data_ ? *data_ : kEmpty;
+}
+
+bool MeshSnapshot::restore(Mesh& mesh) const {
+  if (empty()) {
+    mesh.clear();
+    return true;
+  }
+  if (!buildMesh(mesh, *data_)) {
+    return false;
+  }
+  mesh.normalize_border();
+  return true;
+}
+
+std::size_t MeshSnapshot::memoryBytes() const {
+  if (!data_) {
+    return 0;
+  }
+  return sizeof(double) * data_->positions.capacity() +
+         sizeof(std::uint32_t) * data_->triangles.capacity() +
+         sizeof(std::int32_t) * (data_->ids.capacity() + data_->types.capacity() + data_->levels.capacity()) +
+         data_->borders.capacity();
+}
+
+namespace {
+
+// FNV-1a over 32-bit words.
+class WordHash {
+public:
+  void mix(std::uint32_t word) {
+    h_ ^= word;
+    h_ *= 1099511628211ull;
+  }
+  template <class Values>
+  void mixAll(const Values& values) {
+    mix(static_cast<std::uint32_t>(values.size()));
+    for (auto value : values) {
+      mix(static_cast<std::uint32_t>(value));
+    }
+  }
+  std::uint64_t value() const { return h_; }
+
+private:
+  std::uint64_t h_ = 14695981039346656037ull;
+};
+
+}  // namespace
+
+std::uint64_t connectivityHash(const MeshData& data) {
+  WordHash h;
+  h.mix(static_cast<std::uint32_t>(data.vertexCount()));
+  h.mixAll(data.triangles);
+  h.mixAll(data.ids);
+  h.mixAll(data.types);
+  h.mixAll(data.levels);
+  h.mixAll(data.borders);
+  return h.value();
+}
+
+std::uint64_t contentHash(const MeshData& data) {
+  WordHash h;
+  std::uint64_t connectivity = connectivityHash(data);
+  h.mix(static_cast<std::uint32_t>(connectivity));
+  h.mix(static_cast<std::uint32_t>(connectivity >> 32));
+  for (double p : data.positions) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &p, sizeof(bits));
+    h.mix(static_cast<std::uint32_t>(bits));
+    h.mix(static_cast<std::uint32_t>(bits >> 32));
+  }
+  return h.value();
+}
+
+std::uint64_t triangleHash(const Mesh& mesh) {
+  WordHash h;
+  h.mix(static_cast<std::uint32_t>(mesh.size_of_vertices()));
+  h.mix(static_cast<std::uint32_t>(3 * mesh.size_of_facets()));
+  for (Mesh::Facet_const_iterator f = mesh.facets_begin(); f != mesh.facets_end(); ++f) {
+    Mesh::Halfedge_const_handle e = f->halfedge();
+    h.mix(static_cast<std::uint32_t>(e->vertex()->id));
+    h.mix(static_cast<std::uint32_t>(e->next()->vertex()->id));
+    h.mix(static_cast<std::uint32_t>(e->next()->next()->vertex()->id));
+  }
+  return h.value();
+}
@@ -46,6 +46,22 @@ void MessageBox::addRejectButton(const QString &name){
   connect(b, &QPushButton::clicked, this, &MessageBox::reject);
 }
 
+QPushButton* MessageBox::addButton(const QString &name, const QString &object_name){
+  QPushButton* b = new QPushButton(this);
+  b->setObjectName(object_name);
+  b->setText(name);
+  ui_ptr_->buttons_layout->addWidget(b);
+  return b;
+}
+
+QLabel* MessageBox::addLabel(const QString &name) {
+  QLabel* l = new QLabel(this);
+  l->setObjectName(name);
+  l->setAlignment(Qt::AlignCenter);
+  ui_ptr_->content_layout->addWidget(l);
+  return l;
+}
+
 QLabel* MessageBox::getDescription() {
   return ui_ptr_->description;
 }
@@ -0,0 +1,366 @@
+#include "off_loader.hpp"
+#include "parallel_for.hpp"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <atomic>
+#include <cstring>
+
+namespace {
+
+// Below this many bytes per chunk the threads cost more than they save.
+constexpr std::size_t kMinChunkBytes = 1 << 20;
+// Records parsed between progress reports and cancellation checks.
+constexpr std::size_t kRecordsPerReport = 1 << 16;
+
+const double kPow10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+inline const char* lineEnd(const char* p, const char* end) {
+  const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+  return nl ? nl : end;
+}
+
+// A record is a line that holds anything besides blanks and a comment.
+inline bool isRecord(const char* p, const char* end) {
+  while (p != end && isBlank(*p)) {
+    ++p;
+  }
+  return p != end && *p != '#';
+}
+
+inline bool parseUInt(const char*& p, const char* end, std::uint64_t& out) {
+  while (p != end && isBlank(*p)) {
+    ++p;
+  }
+  if (p == end || !isDigit(*p)) {
+    return false;
+  }
+  std::uint64_t v = 0;
+  for (; p != end && isDigit(*p); ++p) {
+    v = v * 10 + (*p - '0');
+  }
+  out = v;
+  return true;
+}
+
+// Decimal numbers with at most 19 significant digits and a small exponent are
+// converted exactly with one multiplication or division (Clinger's fast
+// path), which covers the output of every mesh exporter we have seen. Longer
+// numbers go through QByteArray::toDouble, which is locale independent.
+inline bool parseDouble(const char*& p, const char* end, double& out) {
+  while (p != end && isBlank(*p)) {
+    ++p;
+  }
+  const char* start = p;
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  std::uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  for (; p != end && isDigit(*p); ++p) {
+    any = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if (mantissa != 0) {
+        ++digits;
+      }
+    } else {
+      ++exponent;
+    }
+  }
+  if (p != end && *p == '.') {
+    ++p;
+    for (; p != end && isDigit(*p); ++p) {
+      any = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa != 0) {
+          ++digits;
+        }
+        --exponent;
+      }
+    }
+  }
+  if (!any) {
+    return false;
+  }
+  if (p != end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    bool exp_negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+      exp_negative = *p == '-';
+      ++p;
+    }
+    if (p == end || !isDigit(*p)) {
+      return false;
+    }
+    int e = 0;
+    for (; p != end && isDigit(*p); ++p) {
+      if (e < 100000) {
+        e = e * 10 + (*p - '0');
+      }
+    }
+    exponent += exp_negative ? -e : e;
+  }
+
+  if (digits < 19 && mantissa <= (std::uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+    double v = static_cast<double>(mantissa);
+    v = exponent < 0 ? v / kPow10[-exponent] : v * kPow10[exponent];
+    out = negative ? -v : v;
+    return true;
+  }
+  bool ok = false;
+  out = QByteArray::fromRawData(start, static_cast<int>(p - start)).toDouble(&ok);
+  return ok;
+}
+
+struct Chunk {
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  std::size_t first_record = 0;
+  std::size_t records = 0;
+  OFFLoader::Status status = OFFLoader::OK;
+  std::size_t bad_record = 0;
+};
+
+void countRecords(Chunk& chunk) {
+  std::size_t records = 0;
+  for (const char* l = chunk.begin; l != chunk.end;) {
+    const char* le = lineEnd(l, chunk.end);
+    if (isRecord(l, le)) {
+      ++records;
+    }
+    l = le == chunk.end ? le : le + 1;
+  }
+  chunk.records = records;
+}
+
+OFFLoader::Status parseRecord(const char* p, const char* end,
+                              std::size_t r, std::size_t vsize,
+                              double* positions, std::uint32_t* triangles) {
+  if (r < vsize) {
+    double* v = positions + 3 * r;
+    if (!parseDouble(p, end, v[0]) || !parseDouble(p, end, v[1]) || !parseDouble(p, end, v[2])) {
+      return OFFLoader::PARSE_ERROR;
+    }
+    return OFFLoader::OK;
+  }
+  std::uint64_t n = 0;
+  if (!parseUInt(p, end, n)) {
+    return OFFLoader::PARSE_ERROR;
+  }
+  if (n != 3) {
+    return OFFLoader::NOT_TRIANGLE;
+  }
+  std::uint32_t* t = triangles + 3 * (r - vsize);
+  for (int i = 0; i < 3; ++i) {
+    std::uint64_t idx = 0;
+    if (!parseUInt(p, end, idx) || idx >= vsize) {
+      return OFFLoader::PARSE_ERROR;
+    }
+    t[i] = static_cast<std::uint32_t>(idx);
+  }
+  return OFFLoader::OK;
+}
+
+// Adds the bytes behind it to `parsed` every kRecordsPerReport records.
+void parseRecords(Chunk& chunk, std::size_t vsize, std::size_t fsize,
+                  double* positions, std::uint32_t* triangles,
+                  const JobControl* job, std::atomic<std::int64_t>& parsed, std::int64_t total) {
+  std::size_t r = chunk.first_record;
+  const char* reported = chunk.begin;
+  for (const char* l = chunk.begin; l != chunk.end && r < vsize + fsize;) {
+    const char* le = lineEnd(l, chunk.end);
+    if (isRecord(l, le)) {
+      chunk.status = parseRecord(l, le, r, vsize, positions, triangles);
+      if (chunk.status != OFFLoader::OK) {
+        chunk.bad_record = r;
+        return;
+      }
+      ++r;
+      if (job && (r - chunk.first_record) % kRecordsPerReport == 0) {
+        if (job->cancelled()) {
+          chunk.status = OFFLoader::CANCELLED;
+          return;
+        }
+        job->report(parsed += l - reported, total);
+        reported = l;
+      }
+    }
+    l = le == chunk.end ? le : le + 1;
+  }
+}
+
+}  // namespace
+
+OFFLoader::Status OFFLoader::load(const QString& filename, MeshData& data, const JobControl* job) {
+  data.clear();
+  stats_ = Stats{};
+  err_.clear();
+
+  QElapsedTimer timer;
+  timer.start();
+  QFile file(filename);
+  if (!file.open(QFile::ReadOnly)) {
+    err_ = "Fail to open " + filename;
+    return OPEN_ERROR;
+  }
+  qint64 size = file.size();
+  uchar* mapped = size > 0 ? file.map(0, size) : nullptr;
+  if (size > 0 && !mapped) {
+    err_ = "Fail to map " + filename;
+    return OPEN_ERROR;
+  }
+  const char* begin = reinterpret_cast<const char*>(mapped);
+  Status status = parse(begin, begin + size, data, job);
+  if (mapped) {
+    file.unmap(mapped);
+  }
+
+  stats_.bytes = size;
+  stats_.nsecs = timer.nsecsElapsed();
+  return status;
+}
+
+OFFLoader::Status OFFLoader::parse(const char* begin, const char* end, MeshData& data, const JobControl* job) {
+  // Header: optional OFF keyword, then vertex, face and edge counts. Comments
+  // and line breaks may appear anywhere in between.
+  const char* p = begin;
+  auto skipSpace = [&p, end]() {
+    while (p != end) {
+      if (*p == '#') {
+        p = lineEnd(p, end);
+      } else if (isBlank(*p) || *p == '\n') {
+        ++p;
+      } else {
+        break;
+      }
+    }
+  };
+  skipSpace();
+  if (p != end && !isDigit(*p)) {
+    const char* keyword = p;
+    while (p != end && !isBlank(*p) && *p != '\n') {
+      ++p;
+    }
+    if (p - keyword < 3 || std::memcmp(p - 3, "OFF", 3) != 0) {
+      err_ = "Missing OFF header";
+      return PARSE_ERROR;
+    }
+    skipSpace();
+    if (p != end && !isDigit(*p)) {
+      err_ = "Binary OFF files are not supported";
+      return PARSE_ERROR;
+    }
+  }
+  std::uint64_t counts[3] = {0, 0, 0};
+  for (std::uint64_t& c : counts) {
+    skipSpace();
+    if (!parseUInt(p, end, c)) {
+      err_ = "Invalid OFF header";
+      return PARSE_ERROR;
+    }
+  }
+  std::size_t vsize = counts[0];
+  std::size_t fsize = counts[1];
+  p = lineEnd(p, end);
+  if (p != end) {
+    ++p;
+  }
+
+  // Split the body at line boundaries so that every record belongs to exactly
+  // one chunk, count the records of every chunk, then parse the chunks in
+  // parallel with their global record offsets known.
+  std::size_t body_size = end - p;
+  std::size_t chunk_count = std::max<std::size_t>(1, std::min(parallelWorkerCount(), body_size / kMinChunkBytes));
+  std::vector<Chunk> chunks(chunk_count);
+  const char* cur = p;
+  for (std::size_t c = 0; c < chunk_count; ++c) {
+    chunks[c].begin = cur;
+    if (c + 1 == chunk_count) {
+      cur = end;
+    } else {
+      const char* split = std::max(cur, p + body_size * (c + 1) / chunk_count);
+      cur = lineEnd(split, end);
+      if (cur != end) {
+        ++cur;
+      }
+    }
+    chunks[c].end = cur;
+  }
+
+  parallelFor(0, chunk_count, 1, [&chunks](std::size_t b, std::size_t e) {
+    for (std::size_t c = b; c < e; ++c) {
+      countRecords(chunks[c]);
+    }
+  });
+
+  std::size_t total = 0;
+  for (Chunk& c : chunks) {
+    c.first_record = total;
+    total += c.records;
+  }
+  if (total < vsize + fsize) {
+    err_ = "Unexpected end of file: expect " + QString::number(vsize + fsize) +
+           " records, found " + QString::number(total);
+    return PARSE_ERROR;
+  }
+  if (job && job->cancelled()) {
+    err_ = "Cancelled";
+    return CANCELLED;
+  }
+
+  data.positions.resize(3 * vsize);
+  data.triangles.resize(3 * fsize);
+  double* positions = data.positions.data();
+  std::uint32_t* triangles = data.triangles.data();
+
+  std::atomic<std::int64_t> parsed(0);
+  parallelFor(0, chunk_count, 1, [&](std::size_t b, std::size_t e) {
+    for (std::size_t c = b; c < e; ++c) {
+      parseRecords(chunks[c], vsize, fsize, positions, triangles, job, parsed, body_size);
+    }
+  });
+
+  for (const Chunk& c : chunks) {
+    if (c.status == CANCELLED) {
+      data.clear();
+      err_ = "Cancelled";
+      return CANCELLED;
+    }
+  }
+  for (const Chunk& c : chunks) {
+    if (c.status == NOT_TRIANGLE) {
+      data.clear();
+      err_ = "Input mesh is not pure triangle.";
+      return NOT_TRIANGLE;
+    }
+    if (c.status != OK) {
+      data.clear();
+      if (c.bad_record < vsize) {
+        err_ = "Invalid vertex " + QString::number(c.bad_record);
+      } else {
+        err_ = "Invalid face " + QString::number(c.bad_record - vsize);
+      }
+      return PARSE_ERROR;
+    }
+  }
+  return OK;
+}
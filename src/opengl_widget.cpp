@@ -222,6 +222,10 @@ void OpenGLWidget::paintGL()
     scene_ptr_->setViewMat(view_);
     scene_ptr_->setProjMat(projection_);
     scene_ptr_->render(shading_type_);
+    // Keep repainting until the GPU finishes the upload and it is swapped in.
+    if (scene_ptr_->uploadPending()) {
+      this->update();
+    }
   } else {
     critical() << "Scene pointer is NULL";
   }
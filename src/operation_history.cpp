@@ -0,0 +1,152 @@
+#include "operation_history.hpp"
+
+#include <algorithm>
+
+CoefficientDelta CoefficientDelta::diff(const CoefficientStore& from, const CoefficientStore& to) {
+  CoefficientDelta delta;
+  delta.size = to.size();
+  const Scalar* fx = from.x();
+  const Scalar* fy = from.y();
+  const Scalar* fz = from.z();
+  const Scalar* tx = to.x();
+  const Scalar* ty = to.y();
+  const Scalar* tz = to.z();
+  for (std::size_t i = 0; i < delta.size; ++i) {
+    if (fx[i] != tx[i] || fy[i] != ty[i] || fz[i] != tz[i]) {
+      delta.index.push_back(static_cast<std::uint32_t>(i));
+      delta.before.insert(delta.before.end(), {fx[i], fy[i], fz[i]});
+      delta.after.insert(delta.after.end(), {tx[i], ty[i], tz[i]});
+    }
+  }
+  return delta;
+}
+
+bool CoefficientDelta::apply(CoefficientStore& coefs, bool forward) const {
+  if (coefs.size() != size) {
+    return false;
+  }
+  const std::vector<Scalar>& values = forward ? after : before;
+  Scalar* x = coefs.x();
+  Scalar* y = coefs.y();
+  Scalar* z = coefs.z();
+  for (std::size_t k = 0; k < index.size(); ++k) {
+    std::uint32_t i = index[k];
+    x[i] = values[3 * k];
+    y[i] = values[3 * k + 1];
+    z[i] = values[3 * k + 2];
+  }
+  return true;
+}
+
+// Merges the two index lists; where both changed a coefficient the value
+// before comes from this delta and the value after from `next`.
+void CoefficientDelta::append(const CoefficientDelta& next) {
+  CoefficientDelta merged;
+  merged.size = next.size;
+  std::size_t a = 0;
+  std::size_t b = 0;
+  auto push = [&merged](std::uint32_t i, const Scalar* before, const Scalar* after) {
+    merged.index.push_back(i);
+    merged.before.insert(merged.before.end(), before, before + 3);
+    merged.after.insert(merged.after.end(), after, after + 3);
+  };
+  while (a < index.size() || b < next.index.size()) {
+    if (b == next.index.size() || (a < index.size() && index[a] < next.index[b])) {
+      push(index[a], &before[3 * a], &after[3 * a]);
+      ++a;
+    } else if (a == index.size() || next.index[b] < index[a]) {
+      push(next.index[b], &next.before[3 * b], &next.after[3 * b]);
+      ++b;
+    } else {
+      push(index[a], &before[3 * a], &next.after[3 * b]);
+      ++a;
+      ++b;
+    }
+  }
+  *this = std::move(merged);
+}
+
+std::size_t CoefficientDelta::memoryBytes() const {
+  return sizeof(std::uint32_t) * index.capacity() + sizeof(Scalar) * (before.capacity() + after.capacity());
+}
+
+// An unmodified mesh is the snapshot of the loaded one, which is kept anyway.
+std::size_t TransformState::memoryBytes() const {
+  return (modified ? mesh.memoryBytes() : 0) + coefs.memoryBytes() + fwt_coefs.memoryBytes() +
+         sizeof(std::uint32_t) * ranking.size() + synthesis_coarse.memoryBytes();
+}
+
+void OperationHistory::setBudget(std::size_t bytes) {
+  budget_ = bytes;
+  evict();
+}
+
+void OperationHistory::push(HistoryEntry entry, bool redoing) {
+  if (!redoing) {
+    for (const HistoryEntry& e : redo_) {
+      bytes_ -= e.bytes;
+    }
+    redo_.clear();
+  }
+  entry.bytes = entryBytes(entry);
+  bytes_ += entry.bytes;
+  undo_.push_back(std::move(entry));
+  evict();
+}
+
+bool OperationHistory::merge(int kind, const OperationParams& after, const CoefficientDelta& delta) {
+  if (undo_.empty() || !redo_.empty() || undo_.back().kind != kind) {
+    return false;
+  }
+  HistoryEntry& top = undo_.back();
+  bytes_ -= top.bytes;
+  top.after = after;
+  top.delta.append(delta);
+  top.bytes = entryBytes(top);
+  bytes_ += top.bytes;
+  evict();
+  return true;
+}
+
+HistoryEntry OperationHistory::takeUndo() {
+  HistoryEntry entry = std::move(undo_.back());
+  undo_.pop_back();
+  bytes_ -= entry.bytes;
+  return entry;
+}
+
+void OperationHistory::pushRedo(HistoryEntry entry) {
+  entry.bytes = entryBytes(entry);
+  bytes_ += entry.bytes;
+  redo_.push_back(std::move(entry));
+  evict();
+}
+
+HistoryEntry OperationHistory::takeRedo() {
+  HistoryEntry entry = std::move(redo_.back());
+  redo_.pop_back();
+  bytes_ -= entry.bytes;
+  return entry;
+}
+
+void OperationHistory::clear() {
+  undo_.clear();
+  redo_.clear();
+  bytes_ = 0;
+}
+
+std::size_t OperationHistory::entryBytes(const HistoryEntry& entry) {
+  return sizeof(HistoryEntry) + entry.state.memoryBytes() + entry.delta.memoryBytes() +
+         sizeof(double) * (entry.before.band_gains.capacity() + entry.after.band_gains.capacity());
+}
+
+void OperationHistory::evict() {
+  while (bytes_ > budget_ && !undo_.empty()) {
+    bytes_ -= undo_.front().bytes;
+    undo_.pop_front();
+  }
+  while (bytes_ > budget_ && !redo_.empty()) {
+    bytes_ -= redo_.front().bytes;
+    redo_.erase(redo_.begin());
+  }
+}
@@ -0,0 +1,187 @@
+#include "render_uploader.hpp"
+#include "triangle_mesh_scene.hpp"
+
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Upper bound on one mapped or staged piece of a buffer.
+constexpr std::size_t kUploadSliceBytes = std::size_t(64) << 20;
+
+}  // namespace
+
+RenderUploader::RenderUploader():
+ThreadedGLBufferUploader(),
+scene_ptr_(nullptr),
+stopping_(false)
+{
+}
+
+void RenderUploader::submit(std::shared_ptr<const RenderPayload> payload) {
+  QMutexLocker lock(&mutex_);
+  if (stopping_) {
+    return;
+  }
+  // A payload still waiting is superseded and dropped.
+  pending_ = std::move(payload);
+  changed_.wakeAll();
+}
+
+void RenderUploader::stop() {
+  QMutexLocker lock(&mutex_);
+  stopping_ = true;
+  changed_.wakeAll();
+}
+
+void RenderUploader::run() {
+  while (true) {
+    std::shared_ptr<const RenderPayload> payload;
+    {
+      QMutexLocker lock(&mutex_);
+      while (!pending_ && !stopping_) {
+        changed_.wait(&mutex_);
+      }
+      if (stopping_) {
+        return;
+      }
+      payload = std::move(pending_);
+      pending_.reset();
+    }
+    upload(*payload);
+    emit bufferUploaded();
+  }
+}
+
+// Writes the back buffer set of the scene. Its index buffers are kept when
+// they already hold the topology of `payload`.
+void RenderUploader::upload(const RenderPayload& payload) {
+  if (!scene_ptr_) {
+    fatal() << "Scene is NULL";
+    return;
+  }
+  splitParts(payload);
+  context_->makeCurrent(surface_);
+  int set = scene_ptr_->beginUpload();
+  const PackedVertex* vertices = payload.vertices.data();
+  if (parts_.empty()) {
+    writeVbo(payload.vertices.size(), sizeof(PackedVertex), TriangleMeshScene::VBO::VERTEX,
+             [&](std::size_t begin, std::size_t end, void* data) {
+      std::memcpy(data, vertices + begin, (end - begin) * sizeof(PackedVertex));
+    });
+  }
+  for (std::size_t k = 0; k < parts_.size(); ++k) {
+    const std::vector<GLuint>& ids = parts_[k].vertices;
+    writeVbo(ids.size(), sizeof(PackedVertex), TriangleMeshScene::partVbo(TriangleMeshScene::VBO::VERTEX, k),
+             [&](std::size_t begin, std::size_t end, void* data) {
+      PackedVertex* out = static_cast<PackedVertex*>(data);
+      for (std::size_t i = begin; i < end; ++i) {
+        out[i - begin] = vertices[ids[i]];
+      }
+    });
+  }
+  const PositionRange& range = payload.range;
+  scene_ptr_->setPositionRange(QVector3D(range.origin[0], range.origin[1], range.origin[2]),
+                               QVector3D(range.extent[0], range.extent[1], range.extent[2]));
+
+  if (!set_valid_[set] || set_topology_[set] != payload.topology) {
+    debug() << "Update index buffers in" << std::max<std::size_t>(1, parts_.size()) << "parts";
+    std::vector<std::size_t> sizes;
+    auto writeIndices = [&](const std::vector<GLuint>& indices, std::size_t part) {
+      writeVbo(indices.size(), sizeof(GLuint), TriangleMeshScene::partVbo(TriangleMeshScene::VBO::INDEX, part),
+               [&](std::size_t begin, std::size_t end, void* data) {
+        std::memcpy(data, indices.data() + begin, (end - begin) * sizeof(GLuint));
+      });
+      sizes.push_back(indices.size());
+    };
+    if (parts_.empty()) {
+      writeIndices(*payload.indices, 0);
+    }
+    for (std::size_t k = 0; k < parts_.size(); ++k) {
+      writeIndices(parts_[k].indices, k);
+    }
+    scene_ptr_->setIndexed(true);
+    scene_ptr_->setPrimitiveSize(payload.indices->size());
+    scene_ptr_->setPartSizes(sizes);
+    set_valid_[set] = true;
+    set_topology_[set] = payload.topology;
+  }
+  scene_ptr_->endUpload();
+  context_->doneCurrent();
+}
+
+// Splits a topology whose vertices or indices exceed one buffer into runs
+// of triangles, each with the vertices it uses renumbered from zero. The
+// parts only change with the topology; a topology that fits leaves none.
+void RenderUploader::splitParts(const RenderPayload& payload) {
+  if (parts_valid_ && parts_topology_ == payload.topology) {
+    return;
+  }
+  parts_.clear();
+  parts_valid_ = true;
+  parts_topology_ = payload.topology;
+  const std::vector<GLuint>& indices = *payload.indices;
+  std::size_t max_vertices = TriangleMeshScene::kMaxBufferBytes / sizeof(PackedVertex);
+  std::size_t max_indices = TriangleMeshScene::kMaxBufferBytes / sizeof(GLuint);
+  if (payload.vertices.size() <= max_vertices && indices.size() <= max_indices) {
+    return;
+  }
+  // owner[v] is one past the last part that took vertex v, local[v] its
+  // index there.
+  std::vector<GLuint> owner(payload.vertices.size(), 0);
+  std::vector<GLuint> local(payload.vertices.size());
+  for (std::size_t t = 0; t + 2 < indices.size(); t += 3) {
+    GLuint id = static_cast<GLuint>(parts_.size());
+    std::size_t fresh = 0;
+    for (int c = 0; c < 3; ++c) {
+      fresh += owner[indices[t + c]] != id;
+    }
+    if (parts_.empty() || parts_.back().vertices.size() + fresh > max_vertices ||
+        parts_.back().indices.size() + 3 > max_indices) {
+      parts_.emplace_back();
+      id = static_cast<GLuint>(parts_.size());
+    }
+    Part& part = parts_.back();
+    for (int c = 0; c < 3; ++c) {
+      GLuint v = indices[t + c];
+      if (owner[v] != id) {
+        owner[v] = id;
+        local[v] = static_cast<GLuint>(part.vertices.size());
+        part.vertices.push_back(v);
+      }
+      part.indices.push_back(local[v]);
+    }
+  }
+  debug() << "Split" << payload.vertices.size() << "vertices into" << parts_.size() << "parts";
+}
+
+// Allocates `vbo` for `count` elements of `size` bytes and fills it in
+// slices of at most kUploadSliceBytes. Each slice is mapped on its own, or
+// written through a staging copy of the slice when that fails.
+void RenderUploader::writeVbo(std::size_t count, std::size_t size, unsigned int vbo, const FillSlice& fill) {
+  scene_ptr_->allocateVboData(count * size, vbo);
+  std::size_t slice = std::max<std::size_t>(1, kUploadSliceBytes / size);
+  std::vector<char> staging;
+  for (std::size_t begin = 0; begin < count; begin += slice) {
+    std::size_t end = std::min(count, begin + slice);
+    std::size_t offset = begin * size;
+    std::size_t bytes = (end - begin) * size;
+    void* data = scene_ptr_->mapVboData(offset, bytes, vbo);
+    if (data) {
+      fill(begin, end, data);
+      if (scene_ptr_->unmapVboData(vbo)) {
+        continue;
+      }
+    }
+    if (staging.empty()) {
+      fatal() << "Unable to map vbo" << vbo << ", writing through a staging copy";
+    }
+    staging.resize(bytes);
+    fill(begin, end, staging.data());
+    scene_ptr_->updateVboData(offset, staging.data(), bytes, vbo);
+  }
+}
@@ -0,0 +1,487 @@
+#include "semi_regular_mesh.hpp"
+#include "mesh_data.hpp"
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+
+namespace {
+
+constexpr std::uint32_t kNone = 0xffffffffu;
+
+enum Parity : std::uint8_t {
+  UNKNOWN = 0,
+  EVEN = 1,
+  ODD = 2
+};
+
+std::uint64_t edgeKey(std::uint32_t a, std::uint32_t b) {
+  return a < b ? (std::uint64_t(a) << 32) | b : (std::uint64_t(b) << 32) | a;
+}
+
+// Neighbour rings by id, in circulator order, with the neighbours across
+// border edges marked.
+struct Rings {
+  std::vector<std::size_t> starts;
+  std::vector<std::uint32_t> neighbors;
+  std::vector<std::uint8_t> border_edge;
+  std::vector<std::uint8_t> border_vertex;
+
+  bool build(const Mesh& mesh) {
+    std::vector<Mesh::Vertex_const_handle> handles;
+    std::size_t n = mesh.size_of_vertices();
+    handles.assign(n, Mesh::Vertex_const_handle());
+    for (auto v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+      if (v->id < 0 || std::size_t(v->id) >= n || handles[v->id] != Mesh::Vertex_const_handle() ||
+          v->halfedge() == Mesh::Halfedge_const_handle()) {
+        return false;
+      }
+      handles[v->id] = v;
+    }
+    starts.assign(1, 0);
+    neighbors.clear();
+    border_edge.clear();
+    border_vertex.assign(n, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+      auto hc = handles[i]->vertex_begin();
+      do {
+        bool border = hc->is_border_edge();
+        neighbors.push_back(hc->opposite()->vertex()->id);
+        border_edge.push_back(border);
+        border_vertex[i] |= border;
+      } while (++hc != handles[i]->vertex_begin());
+      starts.push_back(neighbors.size());
+    }
+    return true;
+  }
+
+  std::size_t size() const { return starts.size() - 1; }
+  std::size_t degree(std::uint32_t v) const { return starts[v + 1] - starts[v]; }
+
+  // The vertex on the far side of `m` from `a`, i.e. the other end of the
+  // coarse edge that `m` splits.
+  std::uint32_t across(std::uint32_t a, std::uint32_t m) const {
+    std::size_t b = starts[m];
+    std::size_t deg = degree(m);
+    std::size_t p = std::find(neighbors.begin() + b, neighbors.begin() + b + deg, a) - neighbors.begin() - b;
+    if (p == deg) {
+      return kNone;
+    }
+    if (border_vertex[m]) {
+      if (deg != 4 || !border_edge[b + p]) {
+        return kNone;
+      }
+      for (std::size_t k = 0; k < deg; ++k) {
+        if (k != p && border_edge[b + k]) {
+          return neighbors[b + k];
+        }
+      }
+      return kNone;
+    }
+    return deg == 6 ? neighbors[b + (p + 3) % 6] : kNone;
+  }
+
+  // Vertices that cannot be the midpoint of a coarse edge.
+  bool irregular(std::uint32_t v) const {
+    return degree(v) != (border_vertex[v] ? 4 : 6);
+  }
+};
+
+// Labels the component of `seed` with `seed` even. On failure the labels
+// of the component are reset.
+bool labelComponent(const Rings& rings, std::uint32_t seed, std::vector<std::uint8_t>& parity) {
+  std::vector<std::uint32_t> visited;
+  std::vector<std::uint32_t> queue = {seed};
+  parity[seed] = EVEN;
+  visited.push_back(seed);
+  bool ok = true;
+  for (std::size_t q = 0; q < queue.size() && ok; ++q) {
+    std::uint32_t a = queue[q];
+    for (std::size_t k = rings.starts[a]; k < rings.starts[a + 1] && ok; ++k) {
+      std::uint32_t m = rings.neighbors[k];
+      if (parity[m] == UNKNOWN) {
+        parity[m] = ODD;
+        visited.push_back(m);
+      }
+      std::uint32_t b = rings.across(a, m);
+      ok = parity[m] == ODD && b != kNone && parity[b] != ODD;
+      if (ok && parity[b] == UNKNOWN) {
+        parity[b] = EVEN;
+        visited.push_back(b);
+        queue.push_back(b);
+      }
+    }
+  }
+  if (!ok) {
+    for (std::uint32_t v : visited) {
+      parity[v] = UNKNOWN;
+    }
+  }
+  return ok;
+}
+
+// One 1-to-4 split undone: `coarse` numbers the even vertices, `midpoints`
+// maps every coarse edge to the fine vertex splitting it.
+struct Split {
+  std::vector<std::uint32_t> coarse;
+  std::vector<std::uint32_t> fine_of_coarse;
+  std::vector<std::uint32_t> triangles;
+  std::unordered_map<std::uint64_t, std::uint32_t> midpoints;
+};
+
+bool peel(const Mesh& mesh, Split& split) {
+  Rings rings;
+  if (!rings.build(mesh)) {
+    return false;
+  }
+  std::size_t n = rings.size();
+  std::vector<std::uint8_t> parity(n, UNKNOWN);
+  std::vector<std::uint8_t> seen(n, 0);
+  for (std::uint32_t v = 0; v < n; ++v) {
+    if (parity[v] != UNKNOWN) {
+      continue;
+    }
+    // An irregular vertex of the component must be even; without one any
+    // vertex is either even or the midpoint of two even neighbours.
+    std::vector<std::uint32_t> component = {v};
+    seen[v] = 1;
+    std::uint32_t seed = kNone;
+    for (std::size_t q = 0; q < component.size() && seed == kNone; ++q) {
+      std::uint32_t a = component[q];
+      if (rings.irregular(a)) {
+        seed = a;
+      }
+      for (std::size_t k = rings.starts[a]; k < rings.starts[a + 1]; ++k) {
+        std::uint32_t w = rings.neighbors[k];
+        if (!seen[w]) {
+          seen[w] = 1;
+          component.push_back(w);
+        }
+      }
+    }
+    std::vector<std::uint32_t> candidates;
+    if (seed != kNone) {
+      candidates.push_back(seed);
+    } else {
+      candidates.push_back(v);
+      candidates.insert(candidates.end(),
+                        rings.neighbors.begin() + rings.starts[v],
+                        rings.neighbors.begin() + rings.starts[v + 1]);
+    }
+    bool labeled = false;
+    for (std::size_t c = 0; c < candidates.size() && !labeled; ++c) {
+      labeled = labelComponent(rings, candidates[c], parity);
+    }
+    if (!labeled) {
+      return false;
+    }
+  }
+
+  split.coarse.assign(n, kNone);
+  split.fine_of_coarse.clear();
+  for (std::uint32_t v = 0; v < n; ++v) {
+    if (parity[v] == EVEN) {
+      split.coarse[v] = static_cast<std::uint32_t>(split.fine_of_coarse.size());
+      split.fine_of_coarse.push_back(v);
+    }
+  }
+
+  split.midpoints.clear();
+  for (std::uint32_t m = 0; m < n; ++m) {
+    if (parity[m] != ODD) {
+      continue;
+    }
+    std::uint32_t parents[2];
+    int count = 0;
+    for (std::size_t k = rings.starts[m]; k < rings.starts[m + 1]; ++k) {
+      std::uint32_t w = rings.neighbors[k];
+      if (parity[w] == EVEN) {
+        if (count == 2) {
+          return false;
+        }
+        parents[count++] = split.coarse[w];
+      }
+    }
+    if (count != 2 || !split.midpoints.emplace(edgeKey(parents[0], parents[1]), m).second) {
+      return false;
+    }
+  }
+
+  // Every corner triangle (a, m_ab, m_ac) yields the coarse triangle
+  // (a, b, c); it is emitted from its smallest coarse vertex only.
+  split.triangles.clear();
+  for (auto f = mesh.facets_begin(); f != mesh.facets_end(); ++f) {
+    auto h = f->halfedge();
+    std::uint32_t t[3] = {std::uint32_t(h->vertex()->id),
+                          std::uint32_t(h->next()->vertex()->id),
+                          std::uint32_t(h->next()->next()->vertex()->id)};
+    int evens = (parity[t[0]] == EVEN) + (parity[t[1]] == EVEN) + (parity[t[2]] == EVEN);
+    if (evens == 0) {
+      continue;
+    }
+    if (evens != 1) {
+      return false;
+    }
+    while (parity[t[0]] != EVEN) {
+      std::rotate(t, t + 1, t + 3);
+    }
+    std::uint32_t b = rings.across(t[0], t[1]);
+    std::uint32_t c = rings.across(t[0], t[2]);
+    if (b == kNone || c == kNone) {
+      return false;
+    }
+    std::uint32_t tri[3] = {split.coarse[t[0]], split.coarse[b], split.coarse[c]};
+    if (tri[0] < tri[1] && tri[0] < tri[2]) {
+      split.triangles.insert(split.triangles.end(), tri, tri + 3);
+    }
+  }
+
+  // The fine mesh must be exactly the coarse vertices plus one vertex per
+  // coarse edge.
+  std::size_t edges = 0;
+  for (std::size_t t = 0; t < split.triangles.size(); t += 3) {
+    for (int e = 0; e < 3; ++e) {
+      std::uint32_t a = split.triangles[t + e];
+      std::uint32_t b = split.triangles[t + (e + 1) % 3];
+      auto it = split.midpoints.find(edgeKey(a, b));
+      if (it == split.midpoints.end()) {
+        return false;
+      }
+      // Interior edges are seen twice, border edges once.
+      edges += rings.border_vertex[it->second] ? 2 : 1;
+    }
+  }
+  return edges == 2 * split.midpoints.size() &&
+         split.fine_of_coarse.size() + split.midpoints.size() == n;
+}
+
+}  // namespace
+
+bool SemiRegularMesh::fromMesh(const Mesh& mesh, int level) {
+  clear();
+  std::size_t n = mesh.size_of_vertices();
+  std::vector<Mesh::Vertex_const_handle> handles(n);
+  for (auto v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
+    if (v->id < 0 || std::size_t(v->id) >= n || handles[v->id] != Mesh::Vertex_const_handle()) {
+      return false;
+    }
+    handles[v->id] = v;
+  }
+  if (level < 0) {
+    return false;
+  }
+
+  // splits[k] undoes the split from level k to level k + 1.
+  std::vector<Split> splits(level);
+  Mesh coarse;
+  for (int k = level - 1; k >= 0; --k) {
+    if (!peel(k == level - 1 ? mesh : coarse, splits[k])) {
+      return false;
+    }
+    std::vector<double> positions(3 * splits[k].fine_of_coarse.size(), 0.0);
+    if (!buildMesh(coarse, positions.data(), splits[k].fine_of_coarse.size(),
+                   splits[k].triangles.data(), splits[k].triangles.size() / 3)) {
+      return false;
+    }
+  }
+
+  std::vector<std::uint32_t> base_triangles;
+  std::size_t base_size = 0;
+  if (level > 0) {
+    base_triangles = splits[0].triangles;
+    base_size = splits[0].fine_of_coarse.size();
+  } else {
+    MeshData data;
+    extractMeshData(mesh, data, false);
+    base_triangles = data.triangles;
+    base_size = data.vertexCount();
+  }
+
+  // finest[k][v] is the id in `mesh` of vertex v of level k.
+  std::vector<std::vector<std::uint32_t>> finest(level + 1);
+  finest[level].resize(n);
+  for (std::size_t v = 0; v < finest[level].size(); ++v) {
+    finest[level][v] = static_cast<std::uint32_t>(v);
+  }
+  for (int k = level - 1; k >= 0; --k) {
+    const std::vector<std::uint32_t>& up = splits[k].fine_of_coarse;
+    finest[k].resize(up.size());
+    for (std::size_t v = 0; v < up.size(); ++v) {
+      finest[k][v] = finest[k + 1][up[v]];
+    }
+  }
+
+  level_ = level;
+  base_vertices_ = base_size;
+  std::unordered_map<std::uint64_t, std::uint32_t> edge_index;
+  patches_.resize(base_triangles.size() / 3);
+  for (std::size_t p = 0; p < patches_.size(); ++p) {
+    Patch& patch = patches_[p];
+    for (int c = 0; c < 3; ++c) {
+      patch.corners[c] = base_triangles[3 * p + c];
+    }
+    const int ends[3][2] = {{0, 1}, {1, 2}, {0, 2}};
+    for (int e = 0; e < 3; ++e) {
+      std::uint32_t a = patch.corners[ends[e][0]];
+      std::uint32_t b = patch.corners[ends[e][1]];
+      auto it = edge_index.emplace(edgeKey(a, b), static_cast<std::uint32_t>(edge_index.size())).first;
+      patch.edges[e] = it->second;
+      patch.forward[e] = a < b;
+    }
+  }
+  edges_ = edge_index.size();
+
+  int r = resolution();
+  std::size_t interior = std::size_t(r - 1) * std::size_t(std::max(r - 2, 0)) / 2;
+  std::size_t total = base_vertices_ + edges_ * (r - 1) + patches_.size() * interior;
+  if (total != n) {
+    clear();
+    return false;
+  }
+  ids_.assign(total, kNone);
+
+  // Splits every sub-triangle down to the finest level, writing the mesh
+  // vertex behind every grid node.
+  struct Corner {
+    std::uint32_t v;
+    int i;
+    int j;
+  };
+  auto place = [&](std::size_t p, const Corner& c, int k) {
+    std::uint32_t id = finest[k][c.v];
+    std::uint32_t& slot = ids_[node(p, c.i, c.j)];
+    if (slot != kNone && slot != id) {
+      return false;
+    }
+    slot = id;
+    return true;
+  };
+  std::vector<std::pair<int, std::array<Corner, 3>>> stack;
+  for (std::size_t p = 0; p < patches_.size(); ++p) {
+    const Patch& patch = patches_[p];
+    std::array<Corner, 3> tri = {Corner{patch.corners[0], 0, 0},
+                                 Corner{patch.corners[1], r, 0},
+                                 Corner{patch.corners[2], 0, r}};
+    for (const Corner& c : tri) {
+      if (!place(p, c, 0)) {
+        clear();
+        return false;
+      }
+    }
+    stack.assign(1, {0, tri});
+    while (!stack.empty()) {
+      int k = stack.back().first;
+      std::array<Corner, 3> t = stack.back().second;
+      stack.pop_back();
+      if (k == level) {
+        continue;
+      }
+      const Split& split = splits[k];
+      Corner up[3];
+      Corner mid[3];
+      for (int c = 0; c < 3; ++c) {
+        up[c] = Corner{split.fine_of_coarse[t[c].v], t[c].i, t[c].j};
+        const Corner& a = t[c];
+        const Corner& b = t[(c + 1) % 3];
+        auto it = split.midpoints.find(edgeKey(a.v, b.v));
+        if (it == split.midpoints.end()) {
+          clear();
+          return false;
+        }
+        mid[c] = Corner{it->second, (a.i + b.i) / 2, (a.j + b.j) / 2};
+        if (!place(p, mid[c], k + 1)) {
+          clear();
+          return false;
+        }
+      }
+      stack.push_back({k + 1, {up[0], mid[0], mid[2]}});
+      stack.push_back({k + 1, {mid[0], up[1], mid[1]}});
+      stack.push_back({k + 1, {mid[2], mid[1], up[2]}});
+      stack.push_back({k + 1, {mid[0], mid[1], mid[2]}});
+    }
+  }
+
+  std::vector<std::uint8_t> used(total, 0);
+  x_.resize(total);
+  y_.resize(total);
+  z_.resize(total);
+  for (std::size_t s = 0; s < total; ++s) {
+    if (ids_[s] == kNone || used[ids_[s]]) {
+      clear();
+      return false;
+    }
+    used[ids_[s]] = 1;
+    const auto& p = handles[ids_[s]]->point();
+    x_[s] = p.x();
+    y_[s] = p.y();
+    z_[s] = p.z();
+  }
+  return true;
+}
+
+bool SemiRegularMesh::toMesh(Mesh& mesh) const {
+  std::size_t n = vertexCount();
+  std::vector<double> positions(3 * n);
+  for (std::size_t s = 0; s < n; ++s) {
+    positions[3 * ids_[s]] = x_[s];
+    positions[3 * ids_[s] + 1] = y_[s];
+    positions[3 * ids_[s] + 2] = z_[s];
+  }
+  int r = resolution();
+  std::vector<std::uint32_t> triangles;
+  triangles.reserve(3 * patches_.size() * r * r);
+  auto push = [&](std::size_t p, int i0, int j0, int i1, int j1, int i2, int j2) {
+    triangles.push_back(ids_[node(p, i0, j0)]);
+    triangles.push_back(ids_[node(p, i1, j1)]);
+    triangles.push_back(ids_[node(p, i2, j2)]);
+  };
+  for (std::size_t p = 0; p < patches_.size(); ++p) {
+    for (int j = 0; j < r; ++j) {
+      for (int i = 0; i + j < r; ++i) {
+        push(p, i, j, i + 1, j, i, j + 1);
+        if (i + j + 1 < r) {
+          push(p, i + 1, j, i + 1, j + 1, i, j + 1);
+        }
+      }
+    }
+  }
+  return buildMesh(mesh, positions.data(), n, triangles.data(), triangles.size() / 3);
+}
+
+void SemiRegularMesh::clear() {
+  level_ = 0;
+  base_vertices_ = 0;
+  edges_ = 0;
+  patches_.clear();
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  ids_.clear();
+}
+
+std::size_t SemiRegularMesh::node(std::size_t patch, int i, int j) const {
+  const Patch& p = patches_[patch];
+  int r = resolution();
+  if (j == 0) {
+    return i == 0 ? p.corners[0] : i == r ? p.corners[1] : edgeNode(p, 0, i);
+  }
+  if (i == 0) {
+    return j == r ? p.corners[2] : edgeNode(p, 2, j);
+  }
+  if (i + j == r) {
+    return edgeNode(p, 1, j);
+  }
+  std::size_t interior = std::size_t(r - 1) * std::size_t(r - 2) / 2;
+  std::size_t row = std::size_t(j - 1) * (r - 1) - std::size_t(j - 1) * j / 2;
+  return base_vertices_ + edges_ * (r - 1) + patch * interior + row + (i - 1);
+}
+
+std::size_t SemiRegularMesh::edgeNode(const Patch& p, int e, int t) const {
+  int r = resolution();
+  return base_vertices_ + std::size_t(p.edges[e]) * (r - 1) + (p.forward[e] ? t - 1 : r - 1 - t);
+}
+
+std::size_t SemiRegularMesh::memoryBytes() const {
+  return 3 * sizeof(double) * x_.size() + sizeof(std::uint32_t) * ids_.size() +
+         sizeof(Patch) * patches_.size();
+}
@@ -0,0 +1,172 @@
+#include "thread_pool.hpp"
+
+#include <chrono>
+
+namespace {
+
+thread_local ThreadPool* current_pool = nullptr;
+
+// Pool and queue of the worker running on this thread, if any.
+thread_local ThreadPool* worker_pool = nullptr;
+thread_local std::size_t worker_queue = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(std::size_t workers)
+  : queued_(0), next_queue_(0), stopping_(false) {
+  start(workers);
+}
+
+ThreadPool::~ThreadPool() {
+  if (current_pool == this) {
+    current_pool = nullptr;
+  }
+  shutdown();
+}
+
+void ThreadPool::setWorkerCount(std::size_t workers) {
+  if (workers == workerCount()) {
+    return;
+  }
+  shutdown();
+  start(workers);
+}
+
+// Workers run nested parallelFor() calls on their own pool.
+ThreadPool* ThreadPool::current() {
+  return current_pool ? current_pool : worker_pool;
+}
+
+void ThreadPool::setCurrent(ThreadPool* pool) {
+  current_pool = pool;
+}
+
+std::map<std::string, ThreadPool::TaskStats> ThreadPool::stats() const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  return stats_;
+}
+
+void ThreadPool::resetStats() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_.clear();
+}
+
+void ThreadPool::start(std::size_t workers) {
+  stopping_ = false;
+  // One queue per worker plus one that only outside threads push to.
+  queues_.clear();
+  for (std::size_t i = 0; i <= workers; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  for (std::size_t i = 0; i < workers; ++i) {
+    workers_.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+void ThreadPool::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+void ThreadPool::push(Task task) {
+  std::size_t queue = worker_pool == this ? worker_queue : queues_.size() - 1;
+  {
+    std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+    queues_[queue]->tasks.push_back(std::move(task));
+  }
+  ++queued_;
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+  }
+  wake_.notify_one();
+  idle_.notify_all();
+}
+
+// Own queue first, newest task first; then the oldest task of another.
+bool ThreadPool::runOne() {
+  Task task;
+  std::size_t n = queues_.size();
+  std::size_t own = worker_pool == this ? worker_queue : n - 1;
+  bool found = pop(own, worker_pool == this, task);
+  std::size_t start = next_queue_++;
+  for (std::size_t k = 0; k < n && !found; ++k) {
+    std::size_t victim = (start + k) % n;
+    found = victim != own && pop(victim, false, task);
+  }
+  if (found) {
+    execute(task);
+  }
+  return found;
+}
+
+bool ThreadPool::pop(std::size_t queue, bool back, Task& task) {
+  Queue& q = *queues_[queue];
+  std::lock_guard<std::mutex> lock(q.mutex);
+  if (q.tasks.empty()) {
+    return false;
+  }
+  if (back) {
+    task = std::move(q.tasks.back());
+    q.tasks.pop_back();
+  } else {
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+  }
+  --queued_;
+  return true;
+}
+
+void ThreadPool::execute(Task& task) {
+  auto start = std::chrono::steady_clock::now();
+  task.func();
+  std::int64_t nsecs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    TaskStats& stats = stats_[task.label];
+    ++stats.count;
+    stats.nsecs += nsecs;
+  }
+  // The group may be gone once its last task is counted down.
+  if (--task.group->pending_ == 0) {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    idle_.notify_all();
+  }
+}
+
+void ThreadPool::work(std::size_t index) {
+  worker_pool = this;
+  worker_queue = index;
+  while (true) {
+    if (runOne()) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+    if (stopping_) {
+      return;
+    }
+  }
+}
+
+void TaskGroup::run(std::function<void()> func) {
+  ++pending_;
+  pool_.push(ThreadPool::Task{std::move(func), this, label_});
+}
+
+void TaskGroup::wait() {
+  while (pending_ > 0) {
+    if (pool_.runOne()) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(pool_.sleep_mutex_);
+    pool_.idle_.wait(lock, [this] { return pending_ == 0 || pool_.queued_ > 0; });
+  }
+}
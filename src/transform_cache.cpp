@@ -0,0 +1,486 @@
+#include "transform_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr std::size_t kMaxEntries = 8;
+constexpr double kVerifyTolerance = 1e-9;
+
+using Vector3 = typename Mesh::Traits::Vector_3;
+using Lanes = std::vector<double>[3];
+
+using Point = typename Mesh::Traits::Point_3;
+
+void buildOutput(const MeshData& output, const Lanes& p, Mesh& mesh) {
+  MeshData data(output);
+  std::size_t n = data.ids.size();
+  data.positions.resize(3 * n);
+  for (std::size_t i = 0; i < n; ++i) {
+    for (int ch = 0; ch < 3; ++ch) {
+      data.positions[3 * i + ch] = p[ch][i];
+    }
+  }
+  buildMesh(mesh, data);
+  mesh.normalize_border();
+}
+
+// Level l of `operators` takes the mesh l levels below the finest one level
+// coarser, so it yields band level - 1 - l. Fails only when cancelled.
+bool runAnalysis(const std::vector<LevelOperator>& operators, Lanes& p, CoefficientStore::Bands& bands,
+                 const JobControl* job) {
+  std::size_t level = operators.size();
+  Lanes out;
+  bands.assign(level, std::vector<Vector3>());
+  for (std::size_t l = 0; l < level; ++l) {
+    if (job && job->cancelled()) {
+      return false;
+    }
+    if (job) {
+      job->report(l, level);
+    }
+    const LevelOperator& op = operators[l];
+    for (int ch = 0; ch < 3; ++ch) {
+      out[ch].resize(op.size());
+    }
+    const double* in[3] = {p[0].data(), p[1].data(), p[2].data()};
+    double* res[3] = {out[0].data(), out[1].data(), out[2].data()};
+    op.apply(in, res);
+    std::vector<Vector3>& band = bands[level - 1 - l];
+    band.reserve(op.bandSize());
+    for (std::size_t k = op.coarseSize(); k < op.size(); ++k) {
+      band.emplace_back(out[0][k], out[1][k], out[2][k]);
+    }
+    for (int ch = 0; ch < 3; ++ch) {
+      out[ch].resize(op.coarseSize());
+      p[ch].swap(out[ch]);
+    }
+  }
+  return true;
+}
+
+bool runSynthesis(const std::vector<LevelOperator>& operators, Lanes& p, const CoefficientStore::Bands& bands,
+                  const JobControl* job) {
+  if (bands.size() < operators.size()) {
+    return false;
+  }
+  for (std::size_t l = 0; l < operators.size(); ++l) {
+    if (bands[l].size() != operators[l].bandSize()) {
+      return false;
+    }
+  }
+  Lanes out;
+  for (std::size_t l = 0; l < operators.size(); ++l) {
+    if (job && job->cancelled()) {
+      return false;
+    }
+    if (job) {
+      job->report(l, operators.size());
+    }
+    const LevelOperator& op = operators[l];
+    for (int ch = 0; ch < 3; ++ch) {
+      p[ch].resize(op.size());
+      out[ch].resize(op.size());
+    }
+    for (std::size_t k = 0; k < op.bandSize(); ++k) {
+      p[0][op.coarseSize() + k] = bands[l][k].x();
+      p[1][op.coarseSize() + k] = bands[l][k].y();
+      p[2][op.coarseSize() + k] = bands[l][k].z();
+    }
+    const double* in[3] = {p[0].data(), p[1].data(), p[2].data()};
+    double* res[3] = {out[0].data(), out[1].data(), out[2].data()};
+    op.apply(in, res);
+    for (int ch = 0; ch < 3; ++ch) {
+      p[ch].swap(out[ch]);
+    }
+  }
+  return true;
+}
+
+// wtlib one level at a time, so that `job` sees every level and can cancel
+// in between. A cancelled or failed run leaves `mesh` partly analyzed.
+bool analyzeLevels(Mesh& mesh, int type, int level, CoefficientStore::Bands& bands, const JobControl* job,
+                   bool& cancelled) {
+  Analyze analyze = analyzer(type);
+  CoefficientStore::Bands one;
+  bands.assign(level, std::vector<Vector3>());
+  for (int l = 0; l < level; ++l) {
+    if (job && job->cancelled()) {
+      cancelled = true;
+      bands.clear();
+      return false;
+    }
+    if (job) {
+      job->report(l, level);
+    }
+    one.clear();
+    if (!analyze(mesh, one, 1) || one.size() != 1) {
+      bands.clear();
+      return false;
+    }
+    bands[level - 1 - l].swap(one[0]);
+  }
+  return true;
+}
+
+// Same for synthesis, which takes band l at level l and fails only when
+// cancelled.
+bool synthesizeLevels(Mesh& mesh, int type, int level, const CoefficientStore::Bands& bands,
+                      const JobControl* job) {
+  Synthesize synthesize = synthesizer(type);
+  CoefficientStore::Bands one(1);
+  for (int l = 0; l < level; ++l) {
+    if (job && job->cancelled()) {
+      return false;
+    }
+    if (job) {
+      job->report(l, level);
+    }
+    one[0] = bands[l];
+    synthesize(mesh, one, 1);
+  }
+  return true;
+}
+
+// Positions and coefficients as one array, for comparing against wtlib.
+std::vector<double> flatten(const Lanes& p, const CoefficientStore::Bands& bands) {
+  std::vector<double> values;
+  for (int ch = 0; ch < 3; ++ch) {
+    values.insert(values.end(), p[ch].begin(), p[ch].end());
+  }
+  for (const std::vector<Vector3>& band : bands) {
+    for (const Vector3& c : band) {
+      values.push_back(c.x());
+      values.push_back(c.y());
+      values.push_back(c.z());
+    }
+  }
+  return values;
+}
+
+bool matches(const std::vector<double>& values, const std::vector<double>& expected) {
+  if (values.size() != expected.size()) {
+    return false;
+  }
+  double scale = 1.0;
+  for (double v : expected) {
+    scale = std::max(scale, std::abs(v));
+  }
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    if (!(std::abs(values[i] - expected[i]) <= kVerifyTolerance * scale)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool readById(const Mesh& mesh, Lanes& p) {
+  std::vector<Mesh::Vertex_const_handle> handles;
+  if (!verticesById(mesh, handles)) {
+    return false;
+  }
+  readPositions(mesh, p[0], p[1], p[2]);
+  return true;
+}
+
+}  // namespace
+
+void TransformCache::setCompiling(bool compiling) {
+  compiling_ = compiling;
+  if (!compiling_) {
+    clear();
+  }
+}
+
+bool TransformCache::analyze(Mesh& mesh, int type, int level, CoefficientStore::Bands& bands,
+                             const JobControl* job) {
+  cancelled_ = false;
+  if (!compiling_) {
+    return analyzeLevels(mesh, type, level, bands, job, cancelled_);
+  }
+  MeshData data;
+  std::uint64_t hash = inputHash(mesh, data);
+  Key key(hash, LevelOperator::ANALYSIS, type, level);
+  Entry& entry = lookup(key);
+  if (entry.operators) {
+    Lanes p;
+    readInput(mesh, data, p);
+    if (!runAnalysis(*entry.operators, p, bands, job)) {
+      bands.clear();
+      cancelled_ = true;
+      return false;
+    }
+    writeOutput(entry, hash, p, mesh);
+    return true;
+  }
+  forgetMesh();
+  if (data.positions.empty()) {
+    extractMeshData(mesh, data, true);
+  }
+
+  bool res = analyzeLevels(mesh, type, level, bands, job, cancelled_);
+  if (cancelled_) {
+    return false;
+  }
+  if (!res) {
+    entry.failed = true;
+  } else if (!entry.failed && entry.seen > 1) {
+    pending_.reset(new Pending{key, MeshSnapshot(std::move(data)), MeshSnapshot(mesh), bands});
+  }
+  return res;
+}
+
+bool TransformCache::synthesize(Mesh& mesh, int type, int level, const CoefficientStore::Bands& bands,
+                                const JobControl* job) {
+  cancelled_ = false;
+  last_synthesis_.reset();
+  if (!compiling_) {
+    cancelled_ = !synthesizeLevels(mesh, type, level, bands, job);
+    return !cancelled_;
+  }
+  MeshData data;
+  std::uint64_t hash = inputHash(mesh, data);
+  Key key(hash, LevelOperator::SYNTHESIS, type, level);
+  Entry& entry = lookup(key);
+  if (entry.operators) {
+    Lanes p;
+    readInput(mesh, data, p);
+    if (runSynthesis(*entry.operators, p, bands, job)) {
+      writeOutput(entry, hash, p, mesh);
+      last_synthesis_ = entry.operators;
+      return true;
+    }
+  }
+  forgetMesh();
+  if (data.positions.empty()) {
+    extractMeshData(mesh, data, true);
+  }
+
+  if (!synthesizeLevels(mesh, type, level, bands, job)) {
+    cancelled_ = true;
+    return false;
+  }
+  if (!entry.operators && !entry.failed && entry.seen > 1) {
+    pending_.reset(new Pending{key, MeshSnapshot(std::move(data)), MeshSnapshot(mesh), bands});
+  }
+  return true;
+}
+
+bool TransformCache::compilePending(const JobControl* job) {
+  std::unique_ptr<Pending> pending = std::move(pending_);
+  if (!pending) {
+    return false;
+  }
+  auto it = entries_.find(pending->key);
+  if (it == entries_.end() || it->second.operators || it->second.failed) {
+    return false;
+  }
+  Entry& entry = it->second;
+  Mesh input;
+  Mesh output;
+  if (!pending->input.restore(input) || !pending->output.restore(output)) {
+    return false;
+  }
+  int type = std::get<2>(pending->key);
+  int level = std::get<3>(pending->key);
+  bool ok = std::get<1>(pending->key) == LevelOperator::ANALYSIS
+      ? compileAnalysis(entry, input, type, level, output, pending->bands, job)
+      : compileSynthesis(entry, input, type, level, pending->bands, output, job);
+  if (!ok && !(job && job->cancelled())) {
+    entry.failed = true;
+  }
+  return ok;
+}
+
+void TransformCache::forgetMesh() {
+  mesh_ = nullptr;
+  mesh_hash_ = 0;
+  handles_.clear();
+}
+
+void TransformCache::clear() {
+  entries_.clear();
+  last_synthesis_.reset();
+  pending_.reset();
+  forgetMesh();
+  spare_.clear();
+  spare_hash_ = 0;
+  has_spare_ = false;
+}
+
+std::size_t TransformCache::memoryBytes() const {
+  std::size_t bytes = 0;
+  for (const auto& kv : entries_) {
+    const Entry& entry = kv.second;
+    if (entry.operators) {
+      for (const LevelOperator& op : *entry.operators) {
+        bytes += op.memoryBytes();
+      }
+    }
+    bytes += sizeof(std::uint32_t) * entry.output.triangles.size() +
+             4 * sizeof(std::int32_t) * entry.output.ids.size();
+  }
+  if (has_spare_) {
+    bytes += sizeof(Mesh::Vertex) * spare_.size_of_vertices() +
+             sizeof(Mesh::Halfedge) * spare_.size_of_halfedges() +
+             sizeof(Mesh::Facet) * spare_.size_of_facets();
+  }
+  bytes += sizeof(Mesh::Vertex_handle) * handles_.capacity();
+  if (pending_) {
+    bytes += pending_->input.memoryBytes() + pending_->output.memoryBytes();
+    for (const std::vector<Vector3>& band : pending_->bands) {
+      bytes += sizeof(Vector3) * band.size();
+    }
+  }
+  return bytes;
+}
+
+TransformCache::Entry& TransformCache::lookup(const Key& key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    if (entries_.size() >= kMaxEntries) {
+      auto oldest = std::min_element(entries_.begin(), entries_.end(), [](const auto& a, const auto& b) {
+        return a.second.used < b.second.used;
+      });
+      entries_.erase(oldest);
+    }
+    it = entries_.emplace(key, Entry()).first;
+  }
+  Entry& entry = it->second;
+  entry.used = ++clock_;
+  ++entry.seen;
+  return entry;
+}
+
+// Flattens `mesh` into `data` unless it is the mesh the last compiled
+// transform returned.
+std::uint64_t TransformCache::inputHash(const Mesh& mesh, MeshData& data) const {
+  if (mesh_ == &mesh) {
+    return mesh_hash_;
+  }
+  extractMeshData(mesh, data, true);
+  return connectivityHash(data);
+}
+
+void TransformCache::readInput(const Mesh& mesh, const MeshData& data, Lanes& p) const {
+  if (mesh_ != &mesh) {
+    std::size_t n = data.vertexCount();
+    for (int ch = 0; ch < 3; ++ch) {
+      p[ch].resize(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        p[ch][i] = data.positions[3 * i + ch];
+      }
+    }
+    return;
+  }
+  for (int ch = 0; ch < 3; ++ch) {
+    p[ch].resize(handles_.size());
+  }
+  for (std::size_t i = 0; i < handles_.size(); ++i) {
+    const Point& q = handles_[i]->point();
+    p[0][i] = q.x();
+    p[1][i] = q.y();
+    p[2][i] = q.z();
+  }
+}
+
+// Writes `p` into the spare when it has the output connectivity of `entry`,
+// otherwise builds the spare from the template, and swaps it with `mesh`.
+// The handles are collected again after the swap, which only has to keep
+// the vertices, not their addresses.
+void TransformCache::writeOutput(const Entry& entry, std::uint64_t input_hash, const Lanes& p, Mesh& mesh) {
+  std::vector<Mesh::Vertex_handle> handles;
+  if (has_spare_ && spare_hash_ == entry.output_hash && verticesById(spare_, handles) &&
+      handles.size() == p[0].size()) {
+    for (std::size_t i = 0; i < handles.size(); ++i) {
+      handles[i]->point() = Point(p[0][i], p[1][i], p[2][i]);
+    }
+  } else {
+    buildOutput(entry.output, p, spare_);
+  }
+  std::swap(mesh, spare_);
+  spare_hash_ = input_hash;
+  has_spare_ = true;
+  mesh_ = &mesh;
+  mesh_hash_ = entry.output_hash;
+  if (!verticesById(mesh, handles_)) {
+    forgetMesh();
+  }
+}
+
+bool TransformCache::compileAnalysis(Entry& entry, const Mesh& fine, int type, int level,
+                                     const Mesh& coarse, const CoefficientStore::Bands& bands,
+                                     const JobControl* job) {
+  auto operators = std::make_shared<std::vector<LevelOperator>>(level);
+  Analyze analyze = analyzer(type);
+  Mesh current(fine);
+  for (int l = 0; l < level; ++l) {
+    Mesh next;
+    bool ok = false;
+    for (int radius = LevelOperator::kMinRadius; radius <= LevelOperator::kMaxRadius && !ok; ++radius) {
+      if (job && job->cancelled()) {
+        return false;
+      }
+      ok = (*operators)[l].compileAnalysis(current, analyze, radius, next, job);
+    }
+    if (!ok) {
+      return false;
+    }
+    current = next;
+  }
+
+  Lanes p;
+  Lanes expected;
+  if (!readById(fine, p) || !readById(coarse, expected)) {
+    return false;
+  }
+  CoefficientStore::Bands result;
+  runAnalysis(*operators, p, result, nullptr);
+  if (!matches(flatten(p, result), flatten(expected, bands))) {
+    return false;
+  }
+  entry.operators = operators;
+  extractMeshData(coarse, entry.output, true);
+  entry.output_hash = connectivityHash(entry.output);
+  entry.output.positions.clear();
+  return true;
+}
+
+bool TransformCache::compileSynthesis(Entry& entry, const Mesh& coarse, int type, int level,
+                                      const CoefficientStore::Bands& bands, const Mesh& fine,
+                                      const JobControl* job) {
+  if (bands.size() < std::size_t(level)) {
+    return false;
+  }
+  auto operators = std::make_shared<std::vector<LevelOperator>>(level);
+  Synthesize synthesize = synthesizer(type);
+  Mesh current(coarse);
+  for (int l = 0; l < level; ++l) {
+    Mesh next;
+    bool ok = false;
+    for (int radius = LevelOperator::kMinRadius; radius <= LevelOperator::kMaxRadius && !ok; ++radius) {
+      if (job && job->cancelled()) {
+        return false;
+      }
+      ok = (*operators)[l].compileSynthesis(current, bands[l].size(), synthesize, radius, next, job);
+    }
+    if (!ok) {
+      return false;
+    }
+    current = next;
+  }
+
+  Lanes p;
+  Lanes expected;
+  if (!readById(coarse, p) || !readById(fine, expected) ||
+      !runSynthesis(*operators, p, bands, nullptr) ||
+      !matches(flatten(p, {}), flatten(expected, {}))) {
+    return false;
+  }
+  entry.operators = operators;
+  extractMeshData(fine, entry.output, true);
+  entry.output_hash = connectivityHash(entry.output);
+  entry.output.positions.clear();
+  return true;
+}
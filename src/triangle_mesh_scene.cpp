@@ -1,14 +1,26 @@
 #include <triangle_mesh_scene.hpp>
 
 #include <QOpenGLShaderProgram>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cstddef>
+
+namespace {
+
+GLenum bufferTarget(const QOpenGLBuffer& buffer)
+{
+  return buffer.type() == QOpenGLBuffer::IndexBuffer ? GL_ELEMENT_ARRAY_BUFFER : GL_ARRAY_BUFFER;
+}
+
+}  // namespace
 
 TriangleMeshScene::TriangleMeshScene(QObject* parent)
 : SceneObject(parent),
-  vpos_(QOpenGLBuffer::VertexBuffer),
-  vnormal_(QOpenGLBuffer::VertexBuffer),
-  fnormal_(QOpenGLBuffer::VertexBuffer),
-  vbarycentric_(QOpenGLBuffer::VertexBuffer),
-  tri_size_(0),
+  front_(0),
+  fence_(nullptr),
   show_edge_(true),
   debug(DebugLogger(QString("[TriangleMeshScene]"))),
   critical(FatalLogger(QString("[TriangleMeshScene]")))
@@ -20,14 +32,16 @@ TriangleMeshScene::TriangleMeshScene(QObject* parent)
 
 TriangleMeshScene::~TriangleMeshScene()
 {
-  vpos_.release();
-  vpos_.destroy();
-  vnormal_.release();
-  vnormal_.destroy();
-  fnormal_.release();
-  fnormal_.destroy();
-  vbarycentric_.release();
-  vbarycentric_.destroy();
+  for (BufferSet& set : sets_) {
+    for (QOpenGLBuffer& vertex : set.vertex) {
+      vertex.release();
+      vertex.destroy();
+    }
+    for (QOpenGLBuffer& index : set.index) {
+      index.release();
+      index.destroy();
+    }
+  }
   vao_.release();
   vao_.destroy();
 }
@@ -37,36 +51,44 @@ void TriangleMeshScene::renderEdge(bool on) {
 }
 void TriangleMeshScene::render(SHADINGTYPE type)
 {
+  swapIfUploaded();
+  BufferSet& set = sets_[front_];
   this->glsl_program_->bind();
   this->vao_.bind();
   this->glsl_program_->setUniformValue("model_mat",  model_);
   this->glsl_program_->setUniformValue("view_mat", view_);
   this->glsl_program_->setUniformValue("projection_mat", proj_);
   this->glsl_program_->setUniformValue("show_edge", show_edge_);
+  this->glsl_program_->setUniformValue("flat_shading", type == SHADINGTYPE::FLAT);
+  this->glsl_program_->setUniformValue("position_origin", set.position_origin);
+  this->glsl_program_->setUniformValue("position_extent", set.position_extent);
 
-  vpos_.bind();
   GLuint pos_location = this->glsl_program_->attributeLocation("v_pos");
-  this->glsl_program_->enableAttributeArray(pos_location);
-  this->glsl_program_->setAttributeArray(pos_location, GL_FLOAT, 0, 3);
-
-  if (type == SHADINGTYPE::SMOOTH) {
-    vnormal_.bind();
-  } else {
-    fnormal_.bind();
-  }
   GLuint normal_location = this->glsl_program_->attributeLocation("v_normal");
+  this->glsl_program_->enableAttributeArray(pos_location);
   this->glsl_program_->enableAttributeArray(normal_location);
-  this->glsl_program_->setAttributeArray(normal_location, GL_FLOAT, 0, 3);
+  // The attribute pointers follow the vertex buffer bound when they are set.
+  auto bindVertices = [&](QOpenGLBuffer& vertex) {
+    vertex.bind();
+    this->glsl_program_->setAttributeBuffer(pos_location, kPackedPositionType,
+                                            offsetof(PackedVertex, position), 3, sizeof(PackedVertex));
+    this->glsl_program_->setAttributeBuffer(normal_location, GL_INT_2_10_10_10_REV,
+                                            offsetof(PackedVertex, normal), 4, sizeof(PackedVertex));
+  };
 
-  vbarycentric_.bind();
-  GLuint barycenter_loc = this->glsl_program_->attributeLocation("v_bary_center");
-  this->glsl_program_->enableAttributeArray(barycenter_loc);
-  this->glsl_program_->setAttributeArray(barycenter_loc, GL_FLOAT, 0, 3);
-
-  glDrawArrays(GL_TRIANGLES, 0, tri_size_);
+  if (set.indexed) {
+    std::size_t parts = std::min({set.part_sizes.size(), set.vertex.size(), set.index.size()});
+    for (std::size_t k = 0; k < parts; ++k) {
+      bindVertices(set.vertex[k]);
+      set.index[k].bind();
+      glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(set.part_sizes[k]), GL_UNSIGNED_INT, nullptr);
+    }
+  } else if (!set.vertex.empty()) {
+    bindVertices(set.vertex[0]);
+    glDrawArrays(GL_TRIANGLES, 0, set.primitive_size);
+  }
   this->glsl_program_->disableAttributeArray(pos_location);
   this->glsl_program_->disableAttributeArray(normal_location);
-  this->glsl_program_->disableAttributeArray(barycenter_loc);
   this->vao_.release();
   this->glsl_program_->release();
 }
@@ -80,17 +102,11 @@ void TriangleMeshScene::init()
   if (!vao_.isCreated()) {
     critical() << " VAO creation failed";
   }
-  if (!vpos_.create()) {
-    critical() << " Unable to create position VBO";
-  }
-  if (!vnormal_.create()){
-    critical() << " Unable to create vertex normal VBO";
-  }
-  if (!fnormal_.create()) {
-    critical() << "Unable to create face nomral VBO";
-  }
-  if (!vbarycentric_.create()) {
-    critical() << " Unable to create barycentric VBO";
+  for (BufferSet& set : sets_) {
+    set.vertex.emplace_back(QOpenGLBuffer::VertexBuffer);
+    if (!set.vertex.back().create()) {
+      critical() << " Unable to create vertex VBO";
+    }
   }
 }
 
@@ -103,6 +119,13 @@ void TriangleMeshScene::loadShader()
                 << this->glsl_program_->log(); 
   }
 
+  if (!this->glsl_program_->addShaderFromSourceFile(QOpenGLShader::Geometry,
+                                             ":/shader/triangle_mesh.geometry"))
+  {
+    critical() << " Geometry shader compile error: "
+                << this->glsl_program_->log();
+  }
+
   if (!this->glsl_program_->addShaderFromSourceFile(QOpenGLShader::Fragment,
                                              ":/shader/triangle_mesh.fragment"))
   {
@@ -149,151 +172,156 @@ void TriangleMeshScene::rotate(const QQuaternion &q)
   model_.rotate(q);
 }
 
-void TriangleMeshScene::allocatePos(int count)
+// Parts are created as they are first used.
+QOpenGLBuffer* TriangleMeshScene::backBuffer(unsigned int vbo)
 {
-  if (vpos_.bind()) {
-    vpos_.allocate(count);
-  } else {
-    critical() << " Unable to bind position VBO while try to allocate pos buffer";
+  BufferSet& set = back();
+  std::size_t part = vbo / 2;
+  bool vertex = vbo % 2 == VBO::VERTEX;
+  std::vector<QOpenGLBuffer>& buffers = vertex ? set.vertex : set.index;
+  while (buffers.size() <= part) {
+    buffers.emplace_back(vertex ? QOpenGLBuffer::VertexBuffer : QOpenGLBuffer::IndexBuffer);
+    if (!buffers.back().create()) {
+      critical() << " Unable to create " << (vertex ? "vertex" : "index") << " VBO";
+    }
   }
+  return &buffers[part];
 }
 
-void TriangleMeshScene::updatePos(int offset, const void *data, int count)
+// QOpenGLBuffer sizes are ints, so storage is allocated and written through
+// the GL calls directly.
+void TriangleMeshScene::allocateVboData(std::size_t count, unsigned int vbo)
 {
-  if (vpos_.bind()) {
-    vpos_.write(offset, data, count);
+  QOpenGLBuffer* buffer = backBuffer(vbo);
+  if (buffer && buffer->bind()) {
+    QOpenGLContext::currentContext()->functions()->glBufferData(bufferTarget(*buffer),
+        static_cast<GLsizeiptr>(count), nullptr, GL_STATIC_DRAW);
   } else {
-    critical() << " Unable to bind position VBO while try to write pos buffer";
+    critical() << "Unable to bind vbo " << vbo << " while try to allocate it";
   }
 }
 
-void TriangleMeshScene::allocateVNormal(int count)
+void TriangleMeshScene::updateVboData(std::size_t offset,
+                                      const void *data,
+                                      std::size_t count,
+                                      unsigned int vbo)
 {
-  if (vnormal_.bind()){
-    vnormal_.allocate(count);
+  QOpenGLBuffer* buffer = backBuffer(vbo);
+  if (buffer && buffer->bind()) {
+    QOpenGLContext::currentContext()->functions()->glBufferSubData(bufferTarget(*buffer),
+        static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(count), data);
   } else {
-    critical() << "Unable to bind vertex normal VBO while try to allocate vertex normal buffer";
+    critical() << "Unable to bind vbo " << vbo << " while try to write it";
   }
 }
 
-void TriangleMeshScene::updateVNormal(int offset, const void *data, int count)
+// The back set is not drawn, and whatever a pending draw may still read
+// was orphaned by allocateVboData(), so the mapping does not synchronize.
+void* TriangleMeshScene::mapVboData(std::size_t offset, std::size_t count, unsigned int vbo)
 {
-  if (vnormal_.bind()){
-    vnormal_.write(offset, data, count);
-  } else {
-    critical() << "Unable to bind vertex normal VBO while try to write vertex normal buffer";
+  QOpenGLBuffer* buffer = backBuffer(vbo);
+  if (!buffer || !buffer->bind()) {
+    critical() << "Unable to bind vbo " << vbo << " while try to map it";
+    return nullptr;
   }
+  return QOpenGLContext::currentContext()->extraFunctions()->glMapBufferRange(bufferTarget(*buffer),
+      static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(count),
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
 }
 
-void TriangleMeshScene::allocateFNormal(int count)
+bool TriangleMeshScene::unmapVboData(unsigned int vbo)
 {
-  if (fnormal_.bind()){
-    fnormal_.allocate(count);
-  } else {
-    critical() << "Unable to bind face normal VBO while try to allocate face normal buffer";
-  }
+  QOpenGLBuffer* buffer = backBuffer(vbo);
+  return buffer && buffer->bind() &&
+         QOpenGLContext::currentContext()->extraFunctions()->glUnmapBuffer(bufferTarget(*buffer)) == GL_TRUE;
 }
 
-void TriangleMeshScene::updateFNormal(int offset, const void *data, int count)
+void TriangleMeshScene::setPrimitiveSize(std::size_t size)
 {
-  if (fnormal_.bind()){
-    fnormal_.write(offset, data, count);
-  } else {
-    critical() << "Unable to bind face normal VBO while try to write face normal buffer";
-  }
+  back().primitive_size = size;
 }
 
-void TriangleMeshScene::allocateBC(int count)
+std::size_t TriangleMeshScene::primitiveSize() const
 {
-  if (vbarycentric_.bind()){
-    vbarycentric_.allocate(count);
-  } else {
-    critical() << "Unable to bind barycentric VBO while try to allocate barycentric buffer";
-  }
+  return sets_[front_].primitive_size;
 }
 
-void TriangleMeshScene::updateBC(int offset, const void *data, int count)
+void TriangleMeshScene::setPositionRange(const QVector3D& origin, const QVector3D& extent)
 {
-  if (vbarycentric_.bind()){
-    vbarycentric_.write(offset, data, count);
-  } else {
-    critical() << "Unable to bind barycentric VBO while try to write barycentric buffer";
-  }
+  back().position_origin = origin;
+  back().position_extent = extent;
 }
 
-void TriangleMeshScene::allocateVboData(int count, unsigned int vbo)
+void TriangleMeshScene::setIndexed(bool on)
 {
-  switch (vbo)
-  {
-    case VBO::POSITION:
-    {
-      allocatePos(count);
-      break;
-    }
-    case VBO::VNORMAL:
-    {
-      allocateVNormal(count);
-      break;
-    }
-    case VBO::FNORMAL:
-    {
-      allocateFNormal(count);
-      break;
-    }
-    case VBO::BARYCENTRIC:
-    {
-      allocateBC(count);
-      break;
-    }
-    default:
-    {
-      critical() << "Try to access unsupported vbo " << vbo;
-      break;
-    }
+  back().indexed = on;
+}
+
+bool TriangleMeshScene::indexed() const
+{
+  return sets_[front_].indexed;
+}
+
+// Buffers of parts beyond `sizes` are released, but for the first vertex
+// buffer.
+void TriangleMeshScene::setPartSizes(const std::vector<std::size_t>& sizes)
+{
+  BufferSet& set = back();
+  set.part_sizes = sizes;
+  while (set.vertex.size() > std::max<std::size_t>(1, sizes.size())) {
+    set.vertex.back().destroy();
+    set.vertex.pop_back();
+  }
+  while (set.index.size() > sizes.size()) {
+    set.index.back().destroy();
+    set.index.pop_back();
   }
 }
 
-void TriangleMeshScene::updateVboData(int offset,
-                                      const void *data,
-                                      int count,
-                                      unsigned int vbo)
+// A finished upload that was never swapped in is simply written over.
+int TriangleMeshScene::beginUpload()
 {
-  switch (vbo)
-  {
-    case VBO::POSITION:
-    {
-      updatePos(offset, data, count);
-      break;
-    }
-    case VBO::VNORMAL:
-    {
-      updateVNormal(offset, data, count);
-      break;
-    }
-    case VBO::FNORMAL:
-    {
-      updateFNormal(offset, data, count);
-      break;
-    }
-    case VBO::BARYCENTRIC:
-    {
-      updateBC(offset, data, count);
-      break;
-    }
-    default:
-    {
-      critical() << "Try to access unsupported vbo " << vbo;
-      break;
-    }
+  QMutexLocker lock(&swap_mutex_);
+  if (fence_) {
+    QOpenGLContext::currentContext()->extraFunctions()->glDeleteSync(fence_);
+    fence_ = nullptr;
   }
+  return 1 - front_;
 }
 
-void TriangleMeshScene::setPrimitiveSize(std::size_t size)
+void TriangleMeshScene::endUpload()
 {
-  tri_size_ = size;
+  QOpenGLExtraFunctions* f = QOpenGLContext::currentContext()->extraFunctions();
+  GLsync fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  // The fence has to reach the GPU before another context can wait on it.
+  f->glFlush();
+  QMutexLocker lock(&swap_mutex_);
+  fence_ = fence;
 }
 
-std::size_t TriangleMeshScene::primitiveSize() const
+bool TriangleMeshScene::uploadPending()
+{
+  QMutexLocker lock(&swap_mutex_);
+  return fence_ != nullptr;
+}
+
+// Polls without blocking, so the GUI keeps drawing the front set until the
+// GPU is done with the back one.
+void TriangleMeshScene::swapIfUploaded()
 {
-  return tri_size_;
-}
\ No newline at end of file
+  QMutexLocker lock(&swap_mutex_);
+  if (!fence_) {
+    return;
+  }
+  QOpenGLExtraFunctions* f = QOpenGLContext::currentContext()->extraFunctions();
+  GLenum state = f->glClientWaitSync(fence_, 0, 0);
+  if (state == GL_TIMEOUT_EXPIRED) {
+    return;
+  }
+  if (state == GL_WAIT_FAILED) {
+    critical() << "Waiting for the uploaded buffers failed";
+  }
+  f->glDeleteSync(fence_);
+  fence_ = nullptr;
+  front_ = 1 - front_;
+}
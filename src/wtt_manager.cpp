@@ -1,5 +1,9 @@
 #include "wtt_manager.hpp"
 #include "triangle_mesh_scene.hpp"
+#include "off_loader.hpp"
+#include "mesh_binary_io.hpp"
+#include "parallel_for.hpp"
+#include "level_operator.hpp"
 
 #include <wtlib/loop_wavelet_transform.hpp>
 #include <wtlib/butterfly_wavelet_transform.hpp>
@@ -9,287 +13,538 @@
 #include <QOffscreenSurface>
 
 #include <QDebug>
-#include <QFile>
+#include <QElapsedTimer>
+#include <QFileInfo>
 
-#include <sstream>
+#include <map>
+#include <mutex>
 
+namespace {
+
+constexpr std::size_t kMinChunkElements = 1 << 13;
+// Vertices or faces filled between progress reports.
+constexpr std::size_t kElementsPerReport = 1 << 20;
+
+}  // namespace
+
+// The pool serves parallelFor() calls of the manager thread only.
 WTTManager::WTTManager():
-ThreadedGLBufferUploader(),
+QThread(),
+pool_(std::max(1u, std::thread::hardware_concurrency()) - 1),
+commands_(job_),
+uploader_(new RenderUploader()),
 debug(DebugLogger("[WTTManager]")),
 critical(FatalLogger("[WTTManager]"))
 {
+  connect(this, &QThread::started, this, [this] { ThreadPool::setCurrent(&pool_); }, Qt::DirectConnection);
+  connect(this, &QThread::finished, this, [] { ThreadPool::setCurrent(nullptr); }, Qt::DirectConnection);
+  job_.setCancellable([this](bool cancellable) { emit this->cancellable(cancellable); });
+  commands_.setPolicy(LOAD, CommandQueue::COALESCE | CommandQueue::PREEMPT | CommandQueue::CANCEL);
+  commands_.setPolicy(FWT, CommandQueue::CANCEL);
+  commands_.setPolicy(IWT, CommandQueue::CANCEL);
+  commands_.setPolicy(COMPRESS, CommandQueue::COALESCE);
+  commands_.setPolicy(DENOISE, CommandQueue::COALESCE);
+  commands_.setPolicy(GAINS, CommandQueue::COALESCE);
+  commands_.setPolicy(COMPILE, CommandQueue::COALESCE | CommandQueue::CANCEL | CommandQueue::YIELD);
+  commands_.setPolicy(WORKERS, CommandQueue::COALESCE);
+}
 
+WTTManager::~WTTManager() {
+  uploader_->stop();
+  uploader_->wait();
+  delete uploader_;
+}
+
+void WTTManager::post(int kind, CommandQueue::Command command) {
+  if (commands_.post(kind, std::move(command))) {
+    QMetaObject::invokeMethod(this, "runCommands", Qt::QueuedConnection);
+  }
+}
+
+// The pool is only restarted on the manager thread, between its jobs.
+void WTTManager::setWorkerCount(std::size_t workers) {
+  post(WORKERS, [this, workers] { pool_.setWorkerCount(workers); });
+}
+
+void WTTManager::cancelJob() {
+  if (commands_.cancel() > 0) {
+    emit jobCancelled();
+  }
+}
+
+// Uploads skipped by superseded commands are caught up once the last
+// command of their kind has run.
+void WTTManager::runCommands() {
+  int kind;
+  CommandQueue::Command command;
+  while (commands_.take(kind, command)) {
+    command();
+    if (render_deferred_ && !commands_.pending(kind)) {
+      render_deferred_ = false;
+      prepareBuffer(preview_ ? equalizer_.mesh() : mesh_for_wt_);
+    }
+  }
+}
+
+// A command preempted by a newer one of its kind ends silently; the newer
+// one reports instead.
+void WTTManager::reportCancelled() {
+  if (!commands_.pending(commands_.running())) {
+    emit jobCancelled();
+  }
+}
+
+// Operators of a repeated transform are compiled once the manager is idle,
+// and the compilation gives way to any request.
+void WTTManager::compileTransforms() {
+  if (!transforms_.hasPending()) {
+    return;
+  }
+  QElapsedTimer timer;
+  timer.start();
+  if (transforms_.compilePending(&job_)) {
+    debug() << "Transform operators compiled in" << timer.elapsed() << "ms,"
+            << transforms_.memoryBytes() / 1024 << "KiB cached";
+  } else if (job_.cancelled()) {
+    debug() << "Transform compilation put off";
+  }
+}
+
+bool WTTManager::deferRender() {
+  if (!commands_.superseded()) {
+    return false;
+  }
+  render_deferred_ = true;
+  return true;
 }
 
 void WTTManager::onLoadMesh(QString filename) {
   debug() << "on loadMesh request";
-  QFile mesh_file(filename);
-  mesh_origin_.clear();
+  QString err;
+  MeshData data;
+  bool binary = QFileInfo(filename).suffix().toLower() == MeshBinaryIO::suffix();
+  // Binary meshes are read in one go once the old one is gone.
+  bool parsed = binary;
+  if (!binary) {
+    trackPercent("Parsing");
+    job_.reportCancellable(true);
+    parsed = readOFFMesh(filename, data, err);
+  }
+  if (job_.cancelled()) {
+    debug() << "Loading" << filename << "cancelled";
+    reportCancelled();
+    return;
+  }
+
+  origin_ = MeshSnapshot();
   mesh_for_wt_.clear();
-  coefs_.clear();
-  if (mesh_file.open(QFile::ReadOnly)) {
-    std::stringstream mesh_stream;
-    mesh_stream << QString(mesh_file.readAll()).toStdString();
-    mesh_stream >> mesh_origin_;
-  } else {
-    critical() << "Unable to open mesh file " << mesh_file.fileName();
-    emit meshLoaded(BoundingBox{}, "Fail to open " + mesh_file.fileName());
-    prepareBuffer(mesh_origin_);
+  transforms_.clear();
+  history_.clear();
+  clearCoefficients();
+  emit progress("Building mesh");
+  job_.reportCancellable(false);
+  bool loaded = parsed && (binary ? loadBinaryMesh(filename, err) : buildOFFMesh(data, err));
+  if (!loaded) {
+    critical() << err;
+    mesh_for_wt_.clear();
+    emit meshLoaded(BoundingBox{}, err);
+    prepareBuffer(mesh_for_wt_);
     return;
   }
 
-  if (mesh_origin_.size_of_vertices() == 0) {
+  if (mesh_for_wt_.size_of_vertices() == 0) {
     critical() << "No vertices data.";
     emit meshLoaded(BoundingBox{}, "No data found");
-    prepareBuffer(mesh_origin_);
+    prepareBuffer(mesh_for_wt_);
     return;
   }
 
-  if (!mesh_origin_.is_pure_triangle()) {
-    critical() << "The mesh is not pure triangle.";
-    emit meshLoaded(BoundingBox{}, "Input mesh is not pure triangle.");
-    prepareBuffer(mesh_origin_);
-    return;
+  mesh_for_wt_.normalize_border();
+  modified_ = false;
+  origin_hash_ = contentHash(origin_.data());
+  debug() << "Original mesh kept in" << origin_.memoryBytes() / 1024 << "KiB";
+  BoundingBox b = computeBBox(mesh_for_wt_);
+  prepareBuffer(mesh_for_wt_);
+  emit meshLoaded(b, "");
+}
+
+bool WTTManager::readOFFMesh(const QString& filename, MeshData& data, QString& err) {
+  OFFLoader loader;
+  OFFLoader::Status status = loader.load(filename, data, &job_);
+  if (status != OFFLoader::OK) {
+    err = loader.errorString();
+    return false;
   }
+  const OFFLoader::Stats& stats = loader.stats();
+  debug() << "Parsed" << stats.bytes << "bytes in" << stats.nsecs / 1e6 << "ms,"
+          << stats.throughput() << "MB/s";
+  return true;
+}
 
-  mesh_origin_.normalize_border();
-  for (auto [v, idx] = std::make_pair(mesh_origin_.vertices_begin(), 0); v != mesh_origin_.vertices_end(); ++v, ++idx) {
-    v->id = idx;
+// The parsed arrays become the snapshot of the original mesh as they are.
+bool WTTManager::buildOFFMesh(MeshData& data, QString& err) {
+  if (!buildMesh(mesh_for_wt_, data)) {
+    err = "Input mesh is not a valid polyhedral surface.";
+    return false;
   }
-  mesh_for_wt_ = mesh_origin_;
-  BoundingBox b = computeBBox(mesh_origin_);
-  prepareBuffer(mesh_origin_);
-  emit meshLoaded(b, "");
+  origin_ = MeshSnapshot(std::move(data));
+  return true;
+}
+
+bool WTTManager::loadBinaryMesh(const QString& filename, QString& err) {
+  MeshBinaryIO io;
+  if (io.load(filename, mesh_for_wt_) != MeshBinaryIO::OK) {
+    err = io.errorString();
+    return false;
+  }
+  debug() << "Mapped and built" << filename << "in" << io.nsecs() / 1e6 << "ms";
+  origin_ = MeshSnapshot(mesh_for_wt_);
+  return true;
 }
 
+// The working mesh is only rebuilt from the snapshot once something has
+// changed it since the last load or reset.
 void WTTManager::onResetMesh() {
-  mesh_for_wt_ = mesh_origin_;
+  history_.clear();
+  synthesis_.clear();
+  equalizer_.clear();
+  preview_ = false;
+  if (modified_) {
+    QElapsedTimer timer;
+    timer.start();
+    if (!origin_.restore(mesh_for_wt_)) {
+      critical() << "Fail to rebuild the original mesh";
+    }
+    transforms_.forgetMesh();
+    modified_ = false;
+    debug() << "Original mesh rebuilt in" << timer.elapsed() << "ms";
+  }
   prepareBuffer(mesh_for_wt_);
   emit meshReset();
 }
 
 
 BoundingBox WTTManager::computeBBox(const Mesh &mesh) {
-  BoundingBox b;
-  b.vsize = mesh.size_of_vertices();
-  b.fsize = mesh.size_of_facets();
+  std::vector<Vertex> vertices;
+  vertices.reserve(mesh.size_of_vertices());
   for (Vertex v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
-    b.xc += v->point().x();
-    b.yc += v->point().y();
-    b.zc += v->point().z();
-    if (v->point().x() > b.xmax) {
-      b.xmax = v->point().x();
-    }
-    if (v->point().x() < b.xmin) {
-      b.xmin = v->point().x();
-    }
+    vertices.push_back(v);
+  }
+  BoundingBox b = computeBBox(vertices);
+  b.fsize = mesh.size_of_facets();
+  return b;
+}
 
-    if (v->point().y() > b.ymax) {
-      b.ymax = v->point().y();
-    }
-    if (v->point().y() < b.ymin) {
-      b.ymin = v->point().y();
+// Chunks are merged in vertex order, so the centroid does not depend on the
+// thread count.
+BoundingBox WTTManager::computeBBox(const std::vector<Vertex>& vertices) {
+  std::mutex mutex;
+  std::map<std::size_t, BoundingBox> parts;
+  parallelFor(0, vertices.size(), kMinChunkElements, [&](std::size_t first, std::size_t last) {
+    BoundingBox part;
+    for (std::size_t i = first; i < last; ++i) {
+      const auto& p = vertices[i]->point();
+      part.xc += p.x();
+      part.yc += p.y();
+      part.zc += p.z();
+      part.xmin = std::min(part.xmin, p.x());
+      part.xmax = std::max(part.xmax, p.x());
+      part.ymin = std::min(part.ymin, p.y());
+      part.ymax = std::max(part.ymax, p.y());
+      part.zmin = std::min(part.zmin, p.z());
+      part.zmax = std::max(part.zmax, p.z());
     }
+    std::lock_guard<std::mutex> lock(mutex);
+    parts[first] = part;
+  }, "computeBBox");
 
-    if (v->point().z() > b.zmax) {
-      b.zmax = v->point().z();
-    }
-    if (v->point().z() < b.zmin) {
-      b.zmin = v->point().z();
-    }
+  BoundingBox b;
+  b.vsize = vertices.size();
+  for (const auto& kv : parts) {
+    const BoundingBox& part = kv.second;
+    b.xc += part.xc;
+    b.yc += part.yc;
+    b.zc += part.zc;
+    b.xmin = std::min(b.xmin, part.xmin);
+    b.xmax = std::max(b.xmax, part.xmax);
+    b.ymin = std::min(b.ymin, part.ymin);
+    b.ymax = std::max(b.ymax, part.ymax);
+    b.zmin = std::min(b.zmin, part.zmin);
+    b.zmax = std::max(b.zmax, part.zmax);
   }
-  b.xc /= static_cast<double>(mesh.size_of_vertices());
-  b.yc /= static_cast<double>(mesh.size_of_vertices());
-  b.zc /= static_cast<double>(mesh.size_of_vertices());
+  b.xc /= static_cast<double>(vertices.size());
+  b.yc /= static_cast<double>(vertices.size());
+  b.zc /= static_cast<double>(vertices.size());
   return b;
 }
 
 void WTTManager::prepareBuffer(const Mesh& mesh) {
-  using Halfedge_circulator = typename Mesh::Halfedge_around_vertex_const_circulator;
+  if (deferRender()) {
+    return;
+  }
   debug() << "Prepare buffers for rendering";
-  std::vector<GLfloat> vpos;
-  std::vector<GLfloat> vbcs;
-  std::vector<GLfloat> vnorms;
-  std::vector<GLfloat> fnorms;
-  vpos.reserve(mesh.size_of_facets() * 9);
-  vbcs.reserve(mesh.size_of_facets() * 9);
-  vnorms.reserve(mesh.size_of_facets() * 9);
-  fnorms.reserve(mesh.size_of_facets() * 9);
-  std::vector<QVector3D> vnorm_buffer(mesh.size_of_vertices());
-  for (Vertex v = mesh.vertices_begin(); v != mesh.vertices_end(); ++v) {
-    QVector3D wn {0.0, 0.0, 0.0};
-    Halfedge_circulator hc = v->vertex_begin();
-    do {
-      Vertex v1 = hc->opposite()->vertex();
-      Vertex v2 = hc->next()->vertex();
-      QVector3D vp(v->point().x(), v->point().y(), v->point().z());
-      QVector3D v1p(v1->point().x(), v1->point().y(), v1->point().z());
-      QVector3D v2p(v2->point().x(), v2->point().y(), v2->point().z());
-      QVector3D normal {QVector3D::normal(v2p - vp, v1p - vp)};
-      float area = 0.5 * QVector3D::crossProduct(v2p - vp, v1p - vp).length();
-      wn += area * normal;
-    } while (++hc != v->vertex_begin());
-    wn.normalize();
-    vnorm_buffer[v->id] = wn;
-  }
-  for (Facet f = mesh.facets_begin(); f != mesh.facets_end(); ++f)
-  {
-    Halfedge hc = f->facet_begin();
-    Vertex v0 = hc->vertex();
-    Vertex v1 = hc->next()->vertex();
-    Vertex v2 = hc->next()->next()->vertex();
-
-    vpos.push_back(static_cast<GLfloat>(v0->point().x()));
-    vpos.push_back(static_cast<GLfloat>(v0->point().y()));
-    vpos.push_back(static_cast<GLfloat>(v0->point().z()));
-
-    vpos.push_back(static_cast<GLfloat>(v1->point().x()));
-    vpos.push_back(static_cast<GLfloat>(v1->point().y()));
-    vpos.push_back(static_cast<GLfloat>(v1->point().z()));
-
-    vpos.push_back(static_cast<GLfloat>(v2->point().x()));
-    vpos.push_back(static_cast<GLfloat>(v2->point().y()));
-    vpos.push_back(static_cast<GLfloat>(v2->point().z()));
-
-    vbcs.push_back(1.0);
-    vbcs.push_back(0.0);
-    vbcs.push_back(0.0);
-
-    vbcs.push_back(0.0);
-    vbcs.push_back(1.0);
-    vbcs.push_back(0.0);
-
-    vbcs.push_back(0.0);
-    vbcs.push_back(0.0);
-    vbcs.push_back(1.0);
-
-    const QVector3D& vnormal0 = vnorm_buffer[v0->id];
-    const QVector3D& vnormal1 = vnorm_buffer[v1->id];
-    const QVector3D& vnormal2 = vnorm_buffer[v2->id];
-
-    vnorms.push_back(static_cast<GLfloat>(vnormal0.x()));
-    vnorms.push_back(static_cast<GLfloat>(vnormal0.y()));
-    vnorms.push_back(static_cast<GLfloat>(vnormal0.z()));
-
-    vnorms.push_back(static_cast<GLfloat>(vnormal1.x()));
-    vnorms.push_back(static_cast<GLfloat>(vnormal1.y()));
-    vnorms.push_back(static_cast<GLfloat>(vnormal1.z()));
-
-    vnorms.push_back(static_cast<GLfloat>(vnormal2.x()));
-    vnorms.push_back(static_cast<GLfloat>(vnormal2.y()));
-    vnorms.push_back(static_cast<GLfloat>(vnormal2.z()));
-
-
-    QVector3D v0p(v0->point().x(), v0->point().y(), v0->point().z());
-    QVector3D v1p(v1->point().x(), v1->point().y(), v1->point().z());
-    QVector3D v2p(v2->point().x(), v2->point().y(), v2->point().z());
-
-    QVector3D fnormal(QVector3D::normal(v1p - v0p, v2p - v0p));
-
-    fnorms.push_back(static_cast<GLfloat>(fnormal.x()));
-    fnorms.push_back(static_cast<GLfloat>(fnormal.y()));
-    fnorms.push_back(static_cast<GLfloat>(fnormal.z()));
-
-    fnorms.push_back(static_cast<GLfloat>(fnormal.x()));
-    fnorms.push_back(static_cast<GLfloat>(fnormal.y()));
-    fnorms.push_back(static_cast<GLfloat>(fnormal.z()));
-
-    fnorms.push_back(static_cast<GLfloat>(fnormal.x()));
-    fnorms.push_back(static_cast<GLfloat>(fnormal.y()));
-    fnorms.push_back(static_cast<GLfloat>(fnormal.z()));
-  }
-  uploadBuffer(vpos, vnorms, fnorms, vbcs);
-  emit bufferUploaded();
+  trackPercent("Preparing faces");
+  job_.reportCancellable(false);
+  submitRender(mesh, triangleHash(mesh), &job_);
   emit updateMeshInfo(mesh.size_of_vertices(), mesh.size_of_facets());
 }
 
-void WTTManager::uploadBuffer(const std::vector<GLfloat> &vpos, const std::vector<GLfloat> &vnorms, const std::vector<GLfloat>& fnorms, const std::vector<GLfloat> &vbcs) {
-  debug() << "Update vertex buffers";
-  if (!scene_ptr_) {
-    critical() << "Scene is NULL";
+// For meshes with the connectivity of the last prepareBuffer() call: the
+// index array of that call is reused.
+void WTTManager::updateGeometry(const Mesh& mesh) {
+  if (deferRender()) {
     return;
   }
-  this->context_->makeCurrent(this->surface_);
-
-  scene_ptr_->allocateVboData(sizeof(GLfloat) * vpos.size(),
-                              TriangleMeshScene::VBO::POSITION);
-  scene_ptr_->updateVboData(0,
-                            vpos.data(),
-                            sizeof(GLfloat) * vpos.size(),
-                            TriangleMeshScene::VBO::POSITION);
-  scene_ptr_->allocateVboData(sizeof(GLfloat) * vnorms.size(),
-                              TriangleMeshScene::VBO::VNORMAL);
-  scene_ptr_->updateVboData(0,
-                            vnorms.data(),
-                            sizeof(GLfloat) * vnorms.size(),
-                            TriangleMeshScene::VBO::VNORMAL);
-  scene_ptr_->allocateVboData(sizeof(GLfloat) * fnorms.size(),
-                              TriangleMeshScene::VBO::FNORMAL);
-  scene_ptr_->updateVboData(0,
-                            fnorms.data(),
-                            sizeof(GLfloat) * fnorms.size(),
-                            TriangleMeshScene::VBO::FNORMAL);
-  scene_ptr_->allocateVboData(sizeof(GLfloat) * vbcs.size(),
-                              TriangleMeshScene::VBO::BARYCENTRIC);
-  scene_ptr_->updateVboData(0,
-                            vbcs.data(),
-                            sizeof(GLfloat) * vbcs.size(),
-                            TriangleMeshScene::VBO::BARYCENTRIC);
-  scene_ptr_->setPrimitiveSize(vpos.size() / 3);
-
-  this->context_->doneCurrent();
+  submitRender(mesh, topology_, nullptr);
+}
+
+// Builds the render payload of `mesh` here and hands it to the uploader
+// thread, replacing a payload that still waits there.
+// Reports the vertices and faces filled to `job` but never stops early.
+void WTTManager::submitRender(const Mesh& mesh, std::uint64_t topology, const JobControl* job) {
+  std::vector<Vertex> vertices;
+  if (!verticesById(mesh, vertices)) {
+    critical() << "Vertex ids are not a permutation, nothing is uploaded";
+    return;
+  }
+  bool new_topology = !indices_ || topology != topology_;
+  std::int64_t total = vertices.size() + (new_topology ? mesh.size_of_facets() : 0);
+  auto payload = std::make_shared<RenderPayload>();
+  payload->range = positionRange(vertices);
+  payload->vertices.resize(vertices.size());
+  for (std::size_t b = 0; b < vertices.size(); b += kElementsPerReport) {
+    std::size_t e = std::min(vertices.size(), b + kElementsPerReport);
+    fillVertices(vertices, b, e, payload->range, payload->vertices.data() + b);
+    if (job) {
+      job->report(e, total);
+    }
+  }
+
+  if (new_topology) {
+    std::vector<Facet> facets;
+    facets.reserve(mesh.size_of_facets());
+    for (Facet f = mesh.facets_begin(); f != mesh.facets_end(); ++f) {
+      facets.push_back(f);
+    }
+    auto indices = std::make_shared<std::vector<GLuint>>(3 * facets.size());
+    for (std::size_t b = 0; b < facets.size(); b += kElementsPerReport) {
+      std::size_t e = std::min(facets.size(), b + kElementsPerReport);
+      fillIndices(facets, b, e, indices->data() + 3 * b);
+      if (job) {
+        job->report(vertices.size() + e, total);
+      }
+    }
+    indices_ = indices;
+    topology_ = topology;
+  }
+  payload->indices = indices_;
+  payload->topology = topology_;
+  uploader_->submit(payload);
+}
+
+// The bounding box of `vertices`, with empty extents widened so every
+// coordinate quantizes.
+PositionRange WTTManager::positionRange(const std::vector<Vertex>& vertices) {
+  BoundingBox b = computeBBox(vertices);
+  PositionRange range;
+  double lo[3] = {b.xmin, b.ymin, b.zmin};
+  double hi[3] = {b.xmax, b.ymax, b.zmax};
+  for (int ch = 0; ch < 3; ++ch) {
+    range.origin[ch] = lo[ch];
+    range.extent[ch] = hi[ch] - lo[ch] > 0.0 ? hi[ch] - lo[ch] : 1.0;
+  }
+  return range;
+}
+
+// Vertices [begin, end) by id, written to packed[0, end - begin).
+void WTTManager::fillVertices(const std::vector<Vertex>& vertices,
+                              std::size_t begin,
+                              std::size_t end,
+                              const PositionRange& range,
+                              PackedVertex* packed) {
+  using Halfedge_circulator = typename Mesh::Halfedge_around_vertex_const_circulator;
+  auto toVector = [](Vertex v) {
+    return QVector3D(v->point().x(), v->point().y(), v->point().z());
+  };
+
+  parallelFor(begin, end, kMinChunkElements, [&](std::size_t first, std::size_t last) {
+    for (std::size_t i = first; i < last; ++i) {
+      Vertex v = vertices[i];
+      QVector3D wn {0.0, 0.0, 0.0};
+      QVector3D vp = toVector(v);
+      Halfedge_circulator hc = v->vertex_begin();
+      do {
+        QVector3D v1p = toVector(hc->opposite()->vertex());
+        QVector3D v2p = toVector(hc->next()->vertex());
+        QVector3D normal {QVector3D::normal(v2p - vp, v1p - vp)};
+        float area = 0.5 * QVector3D::crossProduct(v2p - vp, v1p - vp).length();
+        wn += area * normal;
+      } while (++hc != v->vertex_begin());
+      wn.normalize();
+
+      PackedVertex& pv = packed[i - begin];
+      packPosition(pv, v->point().x(), v->point().y(), v->point().z(), range);
+      pv.normal = packNormal(wn.x(), wn.y(), wn.z());
+    }
+  }, "fillVertices");
+}
+
+// Facets [begin, end), three indices each, written from indices[0].
+void WTTManager::fillIndices(const std::vector<Facet>& facets,
+                             std::size_t begin,
+                             std::size_t end,
+                             GLuint* indices) {
+  parallelFor(begin, end, kMinChunkElements, [&](std::size_t first, std::size_t last) {
+    for (std::size_t f = first; f < last; ++f) {
+      Halfedge hc = facets[f]->facet_begin();
+      GLuint* tri = indices + 3 * (f - begin);
+      tri[0] = hc->vertex()->id;
+      tri[1] = hc->next()->vertex()->id;
+      tri[2] = hc->next()->next()->vertex()->id;
+    }
+  }, "fillIndices");
 }
 
 void WTTManager::onDoFWT(int type, int level) {
-  MeshOps meshops;
-  bool res = false;
-  coefs_.clear();
+  CoefficientStore::Bands bands;
   if (type == WTType::LOOP) {
     debug() << "Performing " << level << " levels Loop FWT";
-    res = wtlib::loop_analyze(mesh_for_wt_, meshops, coefs_, level);
   } else {
     debug() << "Performing " << level << " levels Butterfly FWT";
     if (!mesh_for_wt_.is_closed()) {
+      clearCoefficients();
+      history_.clear();
       emit fwtDone(false, level, "Butterfly WT is not supported on meshes with boundaries.");
       return;
     }
-    res = wtlib::butterfly_analyze(mesh_for_wt_, meshops, coefs_, level);
   }
+  HistoryEntry entry;
+  entry.kind = FWT;
+  entry.type = type;
+  entry.level = level;
+  entry.before = params();
+  entry.state = transformState(snapshot());
+  // Only the loaded mesh is memoized, its hash is known without a pass.
+  bool memoize = !modified_ && !origin_.empty();
+  const AnalysisMemo::Result* memo = memoize ? analyses_.find(origin_hash_, type, level) : nullptr;
+  bool res;
+  if (memo) {
+    res = memo->coarse.restore(mesh_for_wt_);
+    transforms_.forgetMesh();
+  } else {
+    trackSteps("Analyzing");
+    res = transforms_.analyze(mesh_for_wt_, type, level, bands, &job_);
+    if (!res) {
+      // wtlib stops between levels, with the mesh partly analyzed.
+      entry.state.mesh.restore(mesh_for_wt_);
+      transforms_.forgetMesh();
+    }
+    if (transforms_.cancelled()) {
+      debug() << "FWT cancelled";
+      reportCancelled();
+      return;
+    }
+  }
+  modified_ = true;
+  entry.state.has_coefs = true;
+  entry.state.coefs = std::move(coefs_);
+  entry.state.fwt_coefs = std::move(fwt_coefs_);
+  entry.state.ranking = std::move(ranking_);
+  clearCoefficients();
   if (!res) {
+    history_.clear();
     emit fwtDone(false, level, "The mesh does not have " + QString::number(level) + " levels subdivision connectivity.");
     return;
   }
+  if (memo) {
+    fwt_coefs_ = memo->coefs;
+    ranking_ = memo->ranking;
+  } else {
+    fwt_coefs_.fromBands(bands);
+    CoefficientStore::Bands().swap(bands);
+    ranking_.build(fwt_coefs_);
+    if (memoize) {
+      analyses_.insert(origin_hash_, type, level, AnalysisMemo::Result{MeshSnapshot(mesh_for_wt_), fwt_coefs_, ranking_});
+    }
+  }
+  coefs_ = fwt_coefs_;
+  debug() << "FWT results memoized:" << analyses_.hits() << "hits," << analyses_.misses() << "misses,"
+          << analyses_.memoryBytes() / 1024 << "KiB";
+  fwt_type_ = type;
+  fwt_level_ = level;
+  entry.after = params();
+  history_.push(std::move(entry), redoing_);
+  debug() << coefs_.size() << "coefficients stored in" << coefs_.memoryBytes() / 1024 << "KiB";
   prepareBuffer(mesh_for_wt_);
+  logTaskStats("FWT");
   emit fwtDone(true, level, "");
+  if (transforms_.hasPending()) {
+    post(COMPILE, [this] { compileTransforms(); });
+  }
 }
 
 void WTTManager::onDoIWT(int type, int level) {
   using Modifier = wtlib::ptq_impl::PTQ_subdivision_modifier<Mesh, MeshOps>;
-  MeshOps meshops;
-  bool padding = false;
-  if (coefs_.size() < level) {
-    padding = true;
-    coefs_.resize(level);
-  }
-  for (int i = 0; i < coefs_.size(); ++i) {
-    int expect_size = Modifier::get_mesh_size(mesh_for_wt_, MeshOps{}, i + 1) - Modifier::get_mesh_size(mesh_for_wt_, MeshOps{}, i);
-    if (coefs_[i].size() != expect_size) {
-      padding = true;
-      coefs_[i].resize(expect_size, Vector3 {0.0, 0.0, 0.0});
-    }
+  std::vector<std::size_t> expect_sizes(std::max<std::size_t>(coefs_.bandCount(), level));
+  for (std::size_t i = 0; i < expect_sizes.size(); ++i) {
+    expect_sizes[i] = Modifier::get_mesh_size(mesh_for_wt_, MeshOps{}, i + 1) - Modifier::get_mesh_size(mesh_for_wt_, MeshOps{}, i);
   }
 
+  if (type == WTType::BUTTERFLY && !mesh_for_wt_.is_closed()) {
+    emit iwtDone(false, level, "Butterfly WT is not supported on meshes with boundaries.");
+    return;
+  }
+  // The coefficients are padded, and the coarse mesh recorded, only once
+  // the IWT has run all levels; a cancelled one puts the coarse mesh back.
+  CoefficientStore::Bands bands;
+  coefs_.toBands(bands);
+  bands.resize(expect_sizes.size());
+  for (std::size_t i = 0; i < bands.size(); ++i) {
+    bands[i].resize(expect_sizes[i], Vector3(0.0, 0.0, 0.0));
+  }
+  MeshSnapshot coarse = snapshot();
   if (type == WTType::BUTTERFLY) {
     debug() << "Performing " << level << " Butterfly IWT";
-    if (!mesh_for_wt_.is_closed()) {
-      emit iwtDone(false, level, "Butterfly WT is not supported on meshes with boundaries.");
-      return;
-    }
-    wtlib::butterfly_synthesize(mesh_for_wt_, meshops, coefs_, level);
   } else {
     debug() << "Performing " << level << " Loop IWT";
-    wtlib::loop_synthesize(mesh_for_wt_, meshops, coefs_, level);
   }
+  trackSteps("Synthesizing");
+  if (!transforms_.synthesize(mesh_for_wt_, type, level, bands, &job_)) {
+    coarse.restore(mesh_for_wt_);
+    transforms_.forgetMesh();
+    debug() << "IWT cancelled";
+    reportCancelled();
+    return;
+  }
+  CoefficientStore::Bands().swap(bands);
+  // The coefficients are only kept for undoing if they are padded.
+  HistoryEntry entry;
+  entry.kind = IWT;
+  entry.type = type;
+  entry.level = level;
+  entry.before = params();
+  entry.state = transformState(coarse);
+  bool resize_coefs = !coefs_.hasBandSizes(expect_sizes);
+  bool resize_fwt = !fwt_coefs_.hasBandSizes(expect_sizes);
+  entry.state.has_coefs = resize_coefs || resize_fwt;
+  if (entry.state.has_coefs) {
+    entry.state.coefs = coefs_;
+    entry.state.fwt_coefs = fwt_coefs_;
+    entry.state.ranking = ranking_;
+  }
+  modified_ = true;
+  bool padding = resize_coefs && coefs_.resizeBands(expect_sizes);
+  if (resize_fwt) {
+    fwt_coefs_.resizeBands(expect_sizes);
+    ranking_.build(fwt_coefs_);
+  }
+  equalizer_.clear();
+  preview_ = false;
+  synthesis_.record(std::move(coarse), level, coefs_, synthesizer(type));
+  synthesis_.share(transforms_.lastSynthesis());
+  synthesis_type_ = type;
+  entry.after = params();
+  history_.push(std::move(entry), redoing_);
 
   QString msg;
   if (padding) {
@@ -297,52 +552,360 @@ void WTTManager::onDoIWT(int type, int level) {
   } 
 
   prepareBuffer(mesh_for_wt_);
+  logTaskStats("IWT");
   emit iwtDone(true, level,  msg);
+  if (transforms_.hasPending()) {
+    post(COMPILE, [this] { compileTransforms(); });
+  }
 }
 
 void WTTManager::onCompress(double perc) {
   debug() << "Performing compressing with compression rate " << perc << "%";
-  int size = 0;
-  for (const auto& v : coefs_) {
-    size += v.size();
-  }
-  std::vector<std::pair<int, int>> idxmap;
-  idxmap.reserve(size);
-  for (int b = 0; b < coefs_.size(); ++b) {
-    for (int i = 0; i < coefs_[b].size(); ++i) {
-      idxmap.emplace_back(b, i);
+  OperationParams before = params();
+  CoefficientStore previous = std::move(coefs_);
+  compress_perc_ = perc;
+  rebuildCoefficients();
+  std::size_t size = coefs_.size();
+  std::size_t desired_length = ranking_.size() == size ? ranking_.keepCount(perc) : size;
+  QString msg = "Set " + QString::number(size - desired_length) + " out of " + QString::number(size) + " wavelet coefficients to 0";
+
+  if (preview_) {
+    equalizer_.clear();
+    buildEqualizer();
+    refreshPreview();
+  }
+  updateSynthesis();
+  recordEdit(COMPRESS, before, previous);
+  emit compressDone(msg);
+}
+
+void WTTManager::onDenoise(int level) {
+  debug() << "Performing " << level << " levels denosing";
+  OperationParams before = params();
+  CoefficientStore previous = std::move(coefs_);
+  denoise_level_ = level;
+  rebuildCoefficients();
+  refreshPreview();
+  updateSynthesis();
+  recordEdit(DENOISE, before, previous);
+  emit denoiseDone("Set wavelet coefficients in level " + QString::number(level) + " and above to 0");
+}
+
+void WTTManager::onSetBandGains(QVector<double> gains) {
+  OperationParams before = params();
+  CoefficientStore previous = std::move(coefs_);
+  band_gains_.assign(gains.begin(), gains.end());
+  rebuildCoefficients();
+  if (synthesis_.recorded()) {
+    updateSynthesis();
+  } else if (fwt_level_ > 0 && (equalizer_.built() || buildEqualizer())) {
+    if (!preview_) {
+      preview_ = true;
+      equalizer_.apply(bandGains());
+      prepareBuffer(equalizer_.mesh());
+    } else {
+      refreshPreview();
     }
   }
+  recordEdit(GAINS, before, previous);
+  gains_open_ = true;
+}
 
-  auto compare = [this](const auto& l, const auto& r) {
-    const Vector3& lv = coefs_[l.first][l.second];
-    const Vector3& rv = coefs_[r.first][r.second];
-    return lv.squared_length() > rv.squared_length();
-  };
+void WTTManager::onGainsDone() {
+  gains_open_ = false;
+}
 
-  int desired_length = int(idxmap.size() * perc / 100.0);
-  
-  if (desired_length < size) {
-    for (int i = desired_length; i < idxmap.size(); ++i) {
-      std::pair<int, int> idx = idxmap[i];
-      coefs_[idx.first][idx.second] = Vector3{0.0, 0.0, 0.0};
+// Transforms are undone by putting back the state they replaced, parameter
+// edits by writing back the coefficients they changed.
+void WTTManager::onUndo() {
+  if (!history_.canUndo()) {
+    debug() << "Nothing to undo";
+    return;
+  }
+  QElapsedTimer timer;
+  timer.start();
+  gains_open_ = false;
+  HistoryEntry entry = history_.takeUndo();
+  if (entry.kind == FWT || entry.kind == IWT) {
+    restoreState(entry.state, entry.before);
+  } else if (entry.delta.apply(coefs_, false)) {
+    showEdit(entry.after, entry.before);
+  } else {
+    critical() << "Coefficients no longer match the history";
+    history_.clear();
+    return;
+  }
+  debug() << "Undone in" << timer.elapsed() << "ms," << history_.memoryBytes() / 1024 << "KiB of history";
+  history_.pushRedo(std::move(entry));
+  emitHistoryStepped();
+}
+
+// Transforms are run again, which reports through fwtDone() or iwtDone().
+void WTTManager::onRedo() {
+  if (!history_.canRedo()) {
+    debug() << "Nothing to redo";
+    return;
+  }
+  gains_open_ = false;
+  HistoryEntry entry = history_.takeRedo();
+  if (entry.kind == FWT || entry.kind == IWT) {
+    redoing_ = true;
+    if (entry.kind == FWT) {
+      onDoFWT(entry.type, entry.level);
+    } else {
+      onDoIWT(entry.type, entry.level);
     }
+    redoing_ = false;
+    return;
+  }
+  if (!entry.delta.apply(coefs_, true)) {
+    critical() << "Coefficients no longer match the history";
+    history_.clear();
+    return;
   }
-  QString msg = "Set " + QString::number(size > desired_length ? size - desired_length : 0) + " out of " + QString::number(size) + " wavelet coefficients to 0";
+  showEdit(entry.before, entry.after);
+  history_.push(std::move(entry), true);
+  emitHistoryStepped();
+}
 
-  emit compressDone(msg);
+OperationParams WTTManager::params() const {
+  OperationParams p;
+  p.fwt_type = fwt_type_;
+  p.fwt_level = fwt_level_;
+  p.compress_perc = compress_perc_;
+  p.denoise_level = denoise_level_;
+  p.band_gains = band_gains_;
+  p.preview = preview_;
+  return p;
 }
 
-void WTTManager::onDenoise(int level) {
-  debug() << "Performing " << level << " levels denosing";
-  for (int l = 0; l < coefs_.size(); ++l) {
-    if (l + 1 <= level) {
-      continue;
+// Leaves preview_ to the caller.
+void WTTManager::setParams(const OperationParams& p) {
+  fwt_type_ = p.fwt_type;
+  fwt_level_ = p.fwt_level;
+  compress_perc_ = p.compress_perc;
+  denoise_level_ = p.denoise_level;
+  band_gains_ = p.band_gains;
+}
+
+// The working mesh as a snapshot, which is the original one until something
+// has changed it.
+MeshSnapshot WTTManager::snapshot() const {
+  return modified_ ? MeshSnapshot(mesh_for_wt_) : origin_;
+}
+
+// What a transform of `mesh`, the snapshot() taken before it, has to put
+// back when undone. The coefficients are left to the transform.
+TransformState WTTManager::transformState(MeshSnapshot mesh) const {
+  TransformState state;
+  state.modified = modified_;
+  state.mesh = std::move(mesh);
+  if (synthesis_.recorded()) {
+    state.synthesis_coarse = synthesis_.coarse();
+    state.synthesis_level = synthesis_.level();
+    state.synthesis_type = synthesis_type_;
+  }
+  return state;
+}
+
+// Rebuilds the working mesh from the snapshot, then the synthesis record and
+// the preview from the restored coefficients.
+void WTTManager::restoreState(TransformState& state, const OperationParams& params) {
+  if (!state.mesh.restore(mesh_for_wt_)) {
+    critical() << "Fail to rebuild the mesh";
+  }
+  transforms_.forgetMesh();
+  modified_ = state.modified;
+  if (state.has_coefs) {
+    coefs_ = std::move(state.coefs);
+    fwt_coefs_ = std::move(state.fwt_coefs);
+    ranking_ = std::move(state.ranking);
+  }
+  setParams(params);
+  synthesis_.clear();
+  equalizer_.clear();
+  if (state.synthesis_level > 0 && !state.synthesis_coarse.empty()) {
+    synthesis_.record(state.synthesis_coarse, state.synthesis_level, coefs_, synthesizer(state.synthesis_type));
+    synthesis_type_ = state.synthesis_type;
+  }
+  preview_ = params.preview && buildEqualizer();
+  if (preview_) {
+    equalizer_.apply(bandGains());
+  }
+  prepareBuffer(preview_ ? equalizer_.mesh() : mesh_for_wt_);
+}
+
+// Edits are kept as the coefficients they changed. The gain changes of one
+// slider drag make one step.
+void WTTManager::recordEdit(int kind, const OperationParams& before, const CoefficientStore& previous) {
+  if (previous.size() != coefs_.size()) {
+    history_.clear();
+    return;
+  }
+  CoefficientDelta delta = CoefficientDelta::diff(previous, coefs_);
+  OperationParams after = params();
+  if (kind == GAINS && gains_open_ && history_.merge(kind, after, delta)) {
+    return;
+  }
+  HistoryEntry entry;
+  entry.kind = kind;
+  entry.before = before;
+  entry.after = std::move(after);
+  entry.delta = std::move(delta);
+  history_.push(std::move(entry), false);
+}
+
+// Brings the preview or the reconstruction up to date after an undo or redo
+// step has set the coefficients and the parameters `to` directly.
+void WTTManager::showEdit(const OperationParams& from, const OperationParams& to) {
+  setParams(to);
+  if (from.compress_perc != to.compress_perc) {
+    equalizer_.clear();
+  }
+  bool preview = to.preview && (equalizer_.built() || buildEqualizer());
+  if (preview != preview_) {
+    preview_ = preview;
+    if (preview_) {
+      equalizer_.apply(bandGains());
+    }
+    prepareBuffer(preview_ ? equalizer_.mesh() : mesh_for_wt_);
+  } else {
+    refreshPreview();
+  }
+  updateSynthesis();
+}
+
+void WTTManager::emitHistoryStepped() {
+  std::size_t levels = bandGains().size();
+  QVector<double> gains(levels, 1.0);
+  for (std::size_t b = 0; b < std::min(levels, band_gains_.size()); ++b) {
+    gains[b] = band_gains_[b];
+  }
+  emit historyStepped(levels, gains);
+}
+
+void WTTManager::clearCoefficients() {
+  coefs_.clear();
+  fwt_coefs_.clear();
+  ranking_.clear();
+  synthesis_.clear();
+  equalizer_.clear();
+  preview_ = false;
+  fwt_type_ = WTType::LOOP;
+  fwt_level_ = 0;
+  compress_perc_ = 100.0;
+  denoise_level_ = -1;
+  band_gains_.clear();
+}
+
+// Working coefficients are the FWT output with the compression ratio, the
+// denoise level and the band gains applied, in that order.
+void WTTManager::rebuildCoefficients() {
+  coefs_ = fwt_coefs_;
+  if (ranking_.size() == coefs_.size()) {
+    ranking_.zeroTail(coefs_, ranking_.keepCount(compress_perc_));
+  }
+  std::vector<double> gains = bandGains();
+  for (std::size_t b = 0; b < coefs_.bandCount(); ++b) {
+    if (gains[b] == 0.0) {
+      coefs_.setZero(coefs_.bandBegin(b), coefs_.bandEnd(b));
+    } else if (gains[b] != 1.0) {
+      coefs_.scale(coefs_.bandBegin(b), coefs_.bandEnd(b), static_cast<CoefficientStore::Scalar>(gains[b]));
     }
-    std::vector<Vector3>& band_coefs = coefs_[l];
-    for (Vector3& v : band_coefs) {
-      v = Vector3{0.0, 0.0, 0.0};
+  }
+}
+
+std::vector<double> WTTManager::bandGains() const {
+  std::vector<double> gains(std::max<std::size_t>(fwt_coefs_.bandCount(), fwt_level_), 1.0);
+  for (std::size_t b = 0; b < gains.size(); ++b) {
+    if (denoise_level_ >= 0 && b >= std::size_t(denoise_level_)) {
+      gains[b] = 0.0;
+    } else if (b < band_gains_.size()) {
+      gains[b] = band_gains_[b];
     }
   }
-  emit denoiseDone("Set wavelet coefficients in level " + QString::number(level) + " and above to 0");
-}
\ No newline at end of file
+  return gains;
+}
+
+// The equalizer fields hold the compressed but unscaled coefficients; the
+// gains, including zeros for denoised bands, are applied on top.
+bool WTTManager::buildEqualizer() {
+  QElapsedTimer timer;
+  timer.start();
+  CoefficientStore masked = fwt_coefs_;
+  if (ranking_.size() == masked.size()) {
+    ranking_.zeroTail(masked, ranking_.keepCount(compress_perc_));
+  }
+  if (!equalizer_.build(mesh_for_wt_, masked, fwt_level_, synthesizer(fwt_type_))) {
+    critical() << "Fail to build band equalizer";
+    return false;
+  }
+  debug() << "Band equalizer built in" << timer.elapsed() << "ms," << equalizer_.memoryBytes() / 1024 << "KiB";
+  return true;
+}
+
+void WTTManager::refreshPreview() {
+  if (!preview_ || !equalizer_.built()) {
+    return;
+  }
+  equalizer_.apply(bandGains());
+  updateGeometry(equalizer_.mesh());
+}
+
+// After an IWT the reconstructed mesh follows coefficient edits by applying
+// their difference to the synthesized coefficients only.
+void WTTManager::updateSynthesis() {
+  if (!synthesis_.recorded()) {
+    return;
+  }
+  QElapsedTimer timer;
+  timer.start();
+  bool compiled = synthesis_.compiled();
+  if (!synthesis_.update(coefs_, mesh_for_wt_)) {
+    debug() << "Coefficients no longer match the last IWT";
+    synthesis_.clear();
+    return;
+  }
+  // Without operators the update rebuilds the mesh.
+  if (!synthesis_.compiled()) {
+    transforms_.forgetMesh();
+  }
+  if (!compiled && synthesis_.compiled()) {
+    debug() << "Synthesis operators compiled," << synthesis_.memoryBytes() / 1024 << "KiB";
+  }
+  debug() << synthesis_.lastChanged() << "coefficients changed," << synthesis_.lastMoved()
+          << "vertices moved in" << timer.elapsed() << "ms";
+  if (synthesis_.lastMoved() > 0) {
+    prepareBuffer(mesh_for_wt_);
+  }
+}
+
+void WTTManager::logTaskStats(const char* job) {
+  for (const auto& entry : pool_.stats()) {
+    debug() << job << entry.first.c_str() << ":" << entry.second.count << "tasks in"
+            << entry.second.nsecs / 1e6 << "ms";
+  }
+  pool_.resetStats();
+}
+
+// Reports the job from here on as `stage` with its percentage done.
+void WTTManager::trackPercent(const QString& stage) {
+  emit progress(stage);
+  auto last = std::make_shared<std::atomic<int>>(-1);
+  job_.setProgress([this, stage, last](std::int64_t done, std::int64_t total) {
+    int percent = total > 0 ? static_cast<int>(100 * done / total) : 0;
+    if (last->exchange(percent) != percent) {
+      emit progress(stage + " " + QString::number(percent) + "%");
+    }
+  });
+}
+
+// Reports the job from here on as `stage` with the step it is at, where
+// report(k, n) means k of n steps are done. Runs that report no steps,
+// such as wtlib ones, show the bare stage.
+void WTTManager::trackSteps(const QString& stage) {
+  emit progress(stage);
+  job_.setProgress([this, stage](std::int64_t done, std::int64_t total) {
+    emit progress(stage + " level " + QString::number(done + 1) + " of " + QString::number(total));
+  });
+}
@@ -0,0 +1,269 @@
+#include "off_loader.hpp"
+#include "mesh_binary_io.hpp"
+#include "level_operator.hpp"
+#include "semi_regular_mesh.hpp"
+#include "parallel_for.hpp"
+
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QString>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+struct Lanes {
+  std::vector<double> v[3];
+
+  void resize(std::size_t n) {
+    for (int ch = 0; ch < 3; ++ch) {
+      v[ch].resize(n);
+    }
+  }
+};
+
+bool loadMesh(const QString& filename, Mesh& mesh) {
+  if (QFileInfo(filename).suffix().toLower() == MeshBinaryIO::suffix()) {
+    MeshBinaryIO io;
+    if (io.load(filename, mesh) != MeshBinaryIO::OK) {
+      std::cerr << io.errorString().toStdString() << std::endl;
+      return false;
+    }
+  } else {
+    MeshData data;
+    OFFLoader loader;
+    if (loader.load(filename, data) != OFFLoader::OK) {
+      std::cerr << loader.errorString().toStdString() << std::endl;
+      return false;
+    }
+    if (!buildMesh(mesh, data)) {
+      std::cerr << filename.toStdString() << " is not a valid polyhedral surface" << std::endl;
+      return false;
+    }
+  }
+  mesh.normalize_border();
+  return true;
+}
+
+Lanes positions(const Mesh& mesh) {
+  Lanes p;
+  readPositions(mesh, p.v[0], p.v[1], p.v[2]);
+  return p;
+}
+
+double maxDeviation(const Lanes& a, const Lanes& b) {
+  double d = 0.0;
+  for (int ch = 0; ch < 3; ++ch) {
+    for (std::size_t i = 0; i < a.v[ch].size() && i < b.v[ch].size(); ++i) {
+      d = std::max(d, std::abs(a.v[ch][i] - b.v[ch][i]));
+    }
+  }
+  return d;
+}
+
+// analysis[l] takes level l of the mesh, counted from the finest, to the next
+// coarser one; synthesis[l] builds band l, counted from the coarsest.
+void forward(const std::vector<LevelOperator>& analysis, const Lanes& fine, Lanes& coarse, std::vector<Lanes>& bands) {
+  Lanes p = fine;
+  Lanes out;
+  bands.resize(analysis.size());
+  for (std::size_t l = 0; l < analysis.size(); ++l) {
+    const LevelOperator& op = analysis[l];
+    out.resize(op.size());
+    const double* in[3] = {p.v[0].data(), p.v[1].data(), p.v[2].data()};
+    double* res[3] = {out.v[0].data(), out.v[1].data(), out.v[2].data()};
+    op.apply(in, res);
+    Lanes& band = bands[analysis.size() - 1 - l];
+    for (int ch = 0; ch < 3; ++ch) {
+      band.v[ch].assign(out.v[ch].begin() + op.coarseSize(), out.v[ch].end());
+      out.v[ch].resize(op.coarseSize());
+    }
+    std::swap(p, out);
+  }
+  coarse = std::move(p);
+}
+
+void inverse(const std::vector<LevelOperator>& synthesis, const Lanes& coarse, const std::vector<Lanes>& bands, Lanes& fine) {
+  Lanes p = coarse;
+  Lanes out;
+  for (std::size_t l = 0; l < synthesis.size(); ++l) {
+    const LevelOperator& op = synthesis[l];
+    for (int ch = 0; ch < 3; ++ch) {
+      p.v[ch].resize(op.coarseSize());
+      p.v[ch].insert(p.v[ch].end(), bands[l].v[ch].begin(), bands[l].v[ch].end());
+    }
+    out.resize(op.size());
+    const double* in[3] = {p.v[0].data(), p.v[1].data(), p.v[2].data()};
+    double* res[3] = {out.v[0].data(), out.v[1].data(), out.v[2].data()};
+    op.apply(in, res);
+    std::swap(p, out);
+  }
+  fine = std::move(p);
+}
+
+template <class Func>
+double bestOf(int repeats, Func func) {
+  double best = -1.0;
+  QElapsedTimer timer;
+  for (int r = 0; r < repeats; ++r) {
+    timer.start();
+    func();
+    double ms = timer.nsecsElapsed() / 1e6;
+    best = best < 0.0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+}  // namespace
+
+// Times the wavelet transform of a mesh through wtlib and through the level
+// operators compiled from it, and reports how far the operators deviate
+// from wtlib and how much memory the semi-regular form of the mesh takes.
+int main(int argc, char** argv)
+{
+  if (argc < 4 || argc > 5) {
+    std::cerr << "usage: " << argv[0] << " <mesh.off|mesh.wttm> <loop|butterfly> <level> [repeats]" << std::endl;
+    return 1;
+  }
+  QString input = QString::fromLocal8Bit(argv[1]);
+  std::string name(argv[2]);
+  if (name != "loop" && name != "butterfly") {
+    std::cerr << "unknown wavelet " << name << std::endl;
+    return 1;
+  }
+  int type = name == "butterfly" ? 1 : 0;
+  int level = std::atoi(argv[3]);
+  int repeats = argc > 4 ? std::max(1, std::atoi(argv[4])) : 5;
+  if (level <= 0) {
+    std::cerr << "level must be positive" << std::endl;
+    return 1;
+  }
+
+  Mesh fine;
+  if (!loadMesh(input, fine)) {
+    return 1;
+  }
+  Synthesize synthesize = synthesizer(type);
+  Analyze analyze = analyzer(type);
+
+  Mesh coarse;
+  CoefficientStore::Bands bands;
+  bool analyzed = false;
+  double wtlib_fwt_ms = bestOf(repeats, [&]() {
+    coarse = fine;
+    bands.clear();
+    analyzed = analyze(coarse, bands, level);
+  });
+  if (!analyzed) {
+    std::cerr << "the mesh does not have " << level << " levels of subdivision connectivity" << std::endl;
+    return 1;
+  }
+  Mesh synthesized;
+  double wtlib_iwt_ms = bestOf(repeats, [&]() {
+    synthesized = coarse;
+    synthesize(synthesized, bands, level);
+  });
+
+  QElapsedTimer timer;
+  timer.start();
+  std::vector<LevelOperator> analysis(level);
+  std::vector<LevelOperator> synthesis(level);
+  Mesh current(fine);
+  for (int l = 0; l < level; ++l) {
+    Mesh next;
+    bool ok = false;
+    for (int radius = LevelOperator::kMinRadius; radius <= LevelOperator::kMaxRadius && !ok; ++radius) {
+      ok = analysis[l].compileAnalysis(current, analyze, radius, next);
+    }
+    if (!ok) {
+      std::cerr << "could not compile analysis level " << l << std::endl;
+      return 1;
+    }
+    current = next;
+  }
+  for (int l = 0; l < level; ++l) {
+    Mesh next;
+    bool ok = false;
+    for (int radius = LevelOperator::kMinRadius; radius <= LevelOperator::kMaxRadius && !ok; ++radius) {
+      ok = synthesis[l].compileSynthesis(current, bands[l].size(), synthesize, radius, next);
+    }
+    if (!ok) {
+      std::cerr << "could not compile synthesis level " << l << std::endl;
+      return 1;
+    }
+    current = next;
+  }
+  double compile_ms = timer.nsecsElapsed() / 1e6;
+  std::size_t colors = 0;
+  std::size_t bytes = 0;
+  for (int l = 0; l < level; ++l) {
+    colors = std::max({colors, analysis[l].colorCount(), synthesis[l].colorCount()});
+    bytes += analysis[l].memoryBytes() + synthesis[l].memoryBytes();
+  }
+
+  timer.start();
+  SemiRegularMesh patches;
+  bool patched = patches.fromMesh(fine, level);
+  double patch_ms = timer.nsecsElapsed() / 1e6;
+  bool round_trip = false;
+  if (patched) {
+    Mesh rebuilt;
+    round_trip = patches.toMesh(rebuilt) &&
+                 rebuilt.size_of_vertices() == fine.size_of_vertices() &&
+                 rebuilt.size_of_facets() == fine.size_of_facets() &&
+                 maxDeviation(positions(rebuilt), positions(fine)) == 0.0;
+  }
+  std::size_t polyhedron_bytes = sizeof(Mesh::Vertex) * fine.size_of_vertices() +
+                                 sizeof(Mesh::Halfedge) * fine.size_of_halfedges() +
+                                 sizeof(Mesh::Facet) * fine.size_of_facets();
+
+  Lanes wtlib_coarse = positions(coarse);
+  std::vector<Lanes> wtlib_bands(level);
+  for (int l = 0; l < level; ++l) {
+    wtlib_bands[l].resize(bands[l].size());
+    for (std::size_t k = 0; k < bands[l].size(); ++k) {
+      wtlib_bands[l].v[0][k] = bands[l][k].x();
+      wtlib_bands[l].v[1][k] = bands[l][k].y();
+      wtlib_bands[l].v[2][k] = bands[l][k].z();
+    }
+  }
+  Lanes wtlib_fine = positions(synthesized);
+  Lanes input_fine = positions(fine);
+
+  std::cout << "vertices " << fine.size_of_vertices() << ", " << name << " " << level << " levels\n"
+            << "wtlib  FWT " << wtlib_fwt_ms << " ms, IWT " << wtlib_iwt_ms << " ms\n"
+            << "compiled in " << compile_ms << " ms, at most " << colors << " colors, "
+            << bytes / 1024 << " KiB\n";
+  if (patched) {
+    std::cout << "semi-regular " << patches.patchCount() << " patches in " << patch_ms << " ms, "
+              << patches.memoryBytes() / 1024 << " KiB against " << polyhedron_bytes / 1024
+              << " KiB as Polyhedron, round trip " << (round_trip ? "exact" : "FAILED") << "\n";
+  } else {
+    std::cout << "semi-regular patches not recovered\n";
+  }
+
+  ThreadPool pool(parallelWorkerCount() - 1);
+  ThreadPool::setCurrent(&pool);
+  Lanes op_coarse;
+  std::vector<Lanes> op_bands;
+  Lanes op_fine;
+  double op_fwt_ms = bestOf(repeats, [&]() { forward(analysis, input_fine, op_coarse, op_bands); });
+  double op_iwt_ms = bestOf(repeats, [&]() { inverse(synthesis, wtlib_coarse, wtlib_bands, op_fine); });
+  ThreadPool::setCurrent(nullptr);
+  std::cout << "operators on " << pool.workerCount() + 1 << " threads  FWT " << op_fwt_ms
+            << " ms, IWT " << op_iwt_ms << " ms" << std::endl;
+
+  double band_dev = 0.0;
+  for (int l = 0; l < level; ++l) {
+    band_dev = std::max(band_dev, maxDeviation(op_bands[l], wtlib_bands[l]));
+  }
+  double coarse_dev = maxDeviation(op_coarse, wtlib_coarse);
+  double fine_dev = maxDeviation(op_fine, wtlib_fine);
+  std::cout << "max deviation from wtlib: coarse " << coarse_dev
+            << ", bands " << band_dev
+            << ", synthesis " << fine_dev << std::endl;
+  return 0;
+}
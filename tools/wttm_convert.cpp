@@ -0,0 +1,66 @@
+#include "off_loader.hpp"
+#include "mesh_binary_io.hpp"
+
+#include <QElapsedTimer>
+#include <QString>
+
+#include <iostream>
+
+// Converts an OFF file to the native .wttm container and compares how long
+// both formats take to turn into a Polyhedron.
+int main(int argc, char** argv)
+{
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " <input.off> <output.wttm>" << std::endl;
+    return 1;
+  }
+  QString input = QString::fromLocal8Bit(argv[1]);
+  QString output = QString::fromLocal8Bit(argv[2]);
+
+  MeshData data;
+  OFFLoader loader;
+  if (loader.load(input, data) != OFFLoader::OK) {
+    std::cerr << loader.errorString().toStdString() << std::endl;
+    return 1;
+  }
+  QElapsedTimer timer;
+  timer.start();
+  Mesh mesh;
+  if (!buildMesh(mesh, data)) {
+    std::cerr << input.toStdString() << " is not a valid polyhedral surface" << std::endl;
+    return 1;
+  }
+  mesh.normalize_border();
+  double off_parse_ms = loader.stats().nsecs / 1e6;
+  double off_build_ms = timer.nsecsElapsed() / 1e6;
+
+  MeshBinaryIO io;
+  if (io.save(output, mesh) != MeshBinaryIO::OK) {
+    std::cerr << io.errorString().toStdString() << std::endl;
+    return 1;
+  }
+  double save_ms = io.nsecs() / 1e6;
+
+  Mesh reopened;
+  if (io.load(output, reopened) != MeshBinaryIO::OK) {
+    std::cerr << io.errorString().toStdString() << std::endl;
+    return 1;
+  }
+  reopened.normalize_border();
+  double wttm_ms = io.nsecs() / 1e6;
+  double off_ms = off_parse_ms + off_build_ms;
+
+  std::cout << "vertices " << mesh.size_of_vertices()
+            << ", faces " << mesh.size_of_facets() << "\n"
+            << "OFF   parse " << off_parse_ms << " ms (" << loader.stats().throughput() << " MB/s)"
+            << " + build " << off_build_ms << " ms = " << off_ms << " ms\n"
+            << "WTTM  write " << save_ms << " ms, map + build " << wttm_ms << " ms\n"
+            << "speedup " << (wttm_ms > 0 ? off_ms / wttm_ms : 0.0) << "x" << std::endl;
+
+  if (reopened.size_of_vertices() != mesh.size_of_vertices() ||
+      reopened.size_of_facets() != mesh.size_of_facets()) {
+    std::cerr << "reopened mesh does not match the input" << std::endl;
+    return 1;
+  }
+  return 0;
+}